@@ -0,0 +1,137 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arguments.hpp"
+
+#include <QStringList>
+
+#include <algorithm>
+
+using namespace std;
+
+double parseTime( QString time, bool* ok ){
+	double seconds = 0.0;
+	bool valid = true;
+	for( auto part : time.split( ":" ) ){
+		bool part_ok = false;
+		double value = part.toDouble( &part_ok );
+		valid = valid && part_ok && value >= 0;
+		seconds = seconds * 60 + value;
+	}
+	if( ok )
+		*ok = valid;
+	return seconds;
+}
+
+///Parses "value" or "r,g,b" into values
+bool parseChannels( QString text, double values[3] ){
+	auto parts = text.split( "," );
+	if( parts.size() != 1 && parts.size() != 3 )
+		return false;
+	for( int c=0; c<3; c++ ){
+		bool ok = false;
+		values[c] = parts[ parts.size() == 3 ? c : 0 ].toDouble( &ok );
+		if( !ok )
+			return false;
+	}
+	return true;
+}
+
+bool parseOption( const QStringList& args, int& i, Options& options, EncodeSettings& output, bool* ok ){
+	bool valid = true;
+	if( args[i] == "--codec" && i+1 < args.size() )
+		output.codec = args[++i];
+	else if( args[i] == "--preset" && i+1 < args.size() )
+		output.preset = args[++i];
+	else if( args[i] == "--crf" && i+1 < args.size() )
+		output.crf = args[++i];
+	else if( args[i] == "--size" && i+1 < args.size() ){
+		auto size = args[++i].split( "x" );
+		bool height_ok = false;
+		valid = size.size() == 2;
+		if( valid ){
+			output.width = size[0].toUInt( &valid );
+			output.height = size[1].toUInt( &height_ok );
+			valid = valid && height_ok;
+		}
+	}
+	else if( args[i] == "--start" && i+1 < args.size() )
+		options.start = parseTime( args[++i], &valid );
+	else if( args[i] == "--duration" && i+1 < args.size() )
+		options.duration = parseTime( args[++i], &valid );
+	else if( args[i] == "--frames" && i+1 < args.size() ){
+		options.frames = args[++i].toLongLong( &valid );
+		valid = valid && options.frames >= 0;
+	}
+	else if( args[i] == "--head-switch" && i+1 < args.size() )
+		options.head_switch = args[++i].toUInt( &valid );
+	else if( args[i] == "--denoise" && i+1 < args.size() )
+		options.denoise = args[++i].toUInt( &valid );
+	else if( args[i] == "--denoise-threshold" && i+1 < args.size() )
+		options.denoise_threshold = args[++i].toInt( &valid );
+	else if( args[i] == "--stabilise" ){
+		//The amount is optional, anything not a number is the next argument
+		bool ok = false;
+		double amount = i+1 < args.size() ? args[i+1].toDouble( &ok ) : 0.0;
+		options.stabilise = ok ? amount : 0.1;
+		valid = options.stabilise >= 0;
+		if( ok )
+			i++;
+	}
+	else if( args[i] == "--deinterlace" ){
+		bool ok = false;
+		int threshold = i+1 < args.size() ? args[i+1].toInt( &ok ) : 0;
+		options.deinterlace = ok && threshold > 0 ? threshold : 10;
+		if( ok )
+			i++;
+	}
+	else if( args[i] == "--lut" && i+1 < args.size() )
+		options.lut = args[++i];
+	else if( args[i] == "--lift" && i+1 < args.size() )
+		valid = parseChannels( args[++i], options.lift );
+	else if( args[i] == "--gamma" && i+1 < args.size() )
+		valid = parseChannels( args[++i], options.gamma ) && *min_element( options.gamma, options.gamma + 3 ) > 0;
+	else if( args[i] == "--gain" && i+1 < args.size() )
+		valid = parseChannels( args[++i], options.gain );
+	else if( args[i] == "--preview" ){
+		bool ok = false;
+		unsigned interval = i+1 < args.size() ? args[i+1].toUInt( &ok ) : 0;
+		options.preview = ok && interval > 0 ? interval : 4;
+		if( ok )
+			i++;
+	}
+	else if( args[i] == "--checkpoint" && i+1 < args.size() ){
+		options.checkpoint = args[++i].toDouble( &valid );
+		valid = valid && options.checkpoint >= 0;
+	}
+	else if( args[i] == "--resume" )
+		options.resume = true;
+	else if( args[i] == "--max-memory" && i+1 < args.size() ){
+		options.max_memory = size_t( args[++i].toUInt( &valid ) ) * 1024 * 1024;
+		valid = valid && options.max_memory > 0;
+	}
+	else if( args[i] == "--sync-io" )
+		options.io.async = false;
+	else if( args[i] == "--io-latency" && i+1 < args.size() )
+		options.io.latency = args[++i].toUInt( &valid );
+	else
+		return false;
+	
+	if( ok )
+		*ok = valid;
+	return true;
+}
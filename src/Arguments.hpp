@@ -0,0 +1,37 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARGUMENTS_HPP
+#define ARGUMENTS_HPP
+
+#include "Options.hpp"
+#include "VideoEncode.hpp"
+
+#include <QString>
+
+class QStringList;
+
+///Parses "hh:mm:ss.ms", "mm:ss" or plain seconds. ok is set to false if
+///a part isn't a number or is negative
+double parseTime( QString time, bool* ok=nullptr );
+
+///Parses the processing or encode option at args[i] into options or output,
+///advancing i past its values. Returns false if args[i] isn't one of them,
+///ok is set to false if its value is invalid
+bool parseOption( const QStringList& args, int& i, Options& options, EncodeSettings& output, bool* ok=nullptr );
+
+#endif
@@ -0,0 +1,570 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AsyncIO.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+//io_uring is used through the raw system calls, so only the kernel
+//headers are needed and older kernels fall back at runtime
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#include <linux/io_uring.h>
+		#include <sys/syscall.h>
+		#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+			#define VHSFIX_IO_URING
+		#endif
+	#endif
+#endif
+
+using namespace std;
+
+namespace{
+	void delay( unsigned ms ){
+		if( ms > 0 )
+			this_thread::sleep_for( chrono::milliseconds( ms ) );
+	}
+	
+	bool allocateBlocks( vector<IoBlock>& blocks, unsigned count, size_t size ){
+		blocks.resize( max( count, 2u ) );
+		for( auto& block : blocks ){
+			void* data = nullptr;
+			if( posix_memalign( &data, 4096, size ) != 0 )
+				return false;
+			block.data = static_cast<uint8_t*>( data );
+		}
+		return true;
+	}
+	
+	void freeBlocks( vector<IoBlock>& blocks ){
+		for( auto& block : blocks )
+			free( block.data );
+		blocks.clear();
+	}
+	
+	void freeContext( AVIOContext*& context ){
+		if( !context )
+			return;
+		av_freep( &context->buffer );
+		av_freep( &context );
+	}
+	
+	///Only local files are handled here
+	bool isLocalFile( QString path ){
+		const char* protocol = avio_find_protocol_name( path.toLocal8Bit().constData() );
+		return protocol && strcmp( protocol, "file" ) == 0;
+	}
+	
+	///Bytes read, less at the end of the file, -1 on errors
+	int64_t readFully( int file, uint8_t* data, size_t size, int64_t offset ){
+		size_t done = 0;
+		while( done < size ){
+			ssize_t amount = pread( file, data + done, size - done, offset + done );
+			if( amount == 0 )
+				break;
+			if( amount < 0 ){
+				if( errno == EINTR )
+					continue;
+				return -1;
+			}
+			done += amount;
+		}
+		return done;
+	}
+	
+	bool writeFully( int file, const uint8_t* data, size_t size, int64_t offset ){
+		size_t done = 0;
+		while( done < size ){
+			ssize_t amount = pwrite( file, data + done, size - done, offset + done );
+			if( amount < 0 && errno == EINTR )
+				continue;
+			if( amount <= 0 )
+				return false;
+			done += amount;
+		}
+		return true;
+	}
+	
+	///Target of an AVIOContext seek, -1 if not supported
+	int64_t seekTarget( int64_t offset, int whence, int64_t position, int64_t size ){
+		switch( whence & ~AVSEEK_FORCE ){
+			case SEEK_SET: return offset;
+			case SEEK_CUR: return position + offset;
+			case SEEK_END: return size + offset;
+			default: return -1;
+		}
+	}
+	
+	const int avio_buffer_size = 64 * 1024;
+}
+
+
+#ifdef VHSFIX_IO_URING
+///Minimal io_uring for writes, completions are reaped by the submitter
+class Uring{
+	private:
+		int fd{ -1 };
+		void* sq_ring{ MAP_FAILED };
+		void* cq_ring{ MAP_FAILED };
+		size_t sq_size{ 0 }, cq_size{ 0 }, sqes_size{ 0 };
+		io_uring_sqe* sqes{ static_cast<io_uring_sqe*>( MAP_FAILED ) };
+		io_uring_cqe* cqes{ nullptr };
+		unsigned *sq_tail{ nullptr }, *sq_mask{ nullptr }, *sq_array{ nullptr };
+		unsigned *cq_head{ nullptr }, *cq_tail{ nullptr }, *cq_mask{ nullptr };
+		unsigned unsubmitted{ 0 }; ///Queued entries the kernel hasn't taken yet
+		
+		template<typename T>
+		static T* at( void* ring, unsigned offset ){
+			return reinterpret_cast<T*>( static_cast<char*>( ring ) + offset );
+		}
+		
+		int enter( unsigned submit, unsigned wait, unsigned flags ){
+			return syscall( __NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0 );
+		}
+		
+		///Hands the queued entries to the kernel, waiting for wait completions.
+		///Entries it doesn't take stay queued and go in with the next call
+		bool submit( unsigned wait, unsigned flags ){
+			int result = enter( unsubmitted, wait, flags );
+			if( result < 0 )
+				return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+			unsubmitted -= min( unsigned( result ), unsubmitted );
+			return true;
+		}
+		
+	public:
+		Uring( const Uring& ) = delete;
+		Uring() { }
+		~Uring(){
+			if( sqes != MAP_FAILED )
+				munmap( sqes, sqes_size );
+			if( cq_ring != MAP_FAILED )
+				munmap( cq_ring, cq_size );
+			if( sq_ring != MAP_FAILED )
+				munmap( sq_ring, sq_size );
+			if( fd >= 0 )
+				::close( fd );
+		}
+		
+		///False if the kernel doesn't support it
+		bool setup( unsigned entries ){
+			io_uring_params params;
+			memset( &params, 0, sizeof(params) );
+			fd = syscall( __NR_io_uring_setup, entries, &params );
+			if( fd < 0 )
+				return false;
+			
+			sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+			sq_ring = mmap( nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+			cq_ring = mmap( nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+			sqes = static_cast<io_uring_sqe*>( mmap( nullptr, sqes_size
+				,	PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES ) );
+			if( sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED )
+				return false;
+			
+			sq_tail  = at<unsigned>( sq_ring, params.sq_off.tail );
+			sq_mask  = at<unsigned>( sq_ring, params.sq_off.ring_mask );
+			sq_array = at<unsigned>( sq_ring, params.sq_off.array );
+			cq_head  = at<unsigned>( cq_ring, params.cq_off.head );
+			cq_tail  = at<unsigned>( cq_ring, params.cq_off.tail );
+			cq_mask  = at<unsigned>( cq_ring, params.cq_off.ring_mask );
+			cqes = at<io_uring_cqe>( cq_ring, params.cq_off.cqes );
+			return true;
+		}
+		
+		///The caller must not have more writes in flight than entries.
+		///Once queued the write is never dropped, even if the kernel doesn't
+		///take it now, so false only means the ring itself failed
+		bool write( int file, IoBlock* block ){
+			block->vec.iov_base = block->data;
+			block->vec.iov_len = block->used;
+			
+			unsigned tail = *sq_tail;
+			unsigned index = tail & *sq_mask;
+			io_uring_sqe& sqe = sqes[index];
+			memset( &sqe, 0, sizeof(sqe) );
+			sqe.opcode = IORING_OP_WRITEV;
+			sqe.fd = file;
+			sqe.addr = reinterpret_cast<uintptr_t>( &block->vec );
+			sqe.len = 1;
+			sqe.off = block->offset;
+			sqe.user_data = reinterpret_cast<uintptr_t>( block );
+			sq_array[index] = index;
+			__atomic_store_n( sq_tail, tail + 1, __ATOMIC_RELEASE );
+			unsubmitted++;
+			return submit( 0, 0 );
+		}
+		
+		///Waits for a write to complete, false on errors of the ring itself
+		bool wait( IoBlock*& block, int& result ){
+			while( true ){
+				unsigned head = *cq_head;
+				if( head != __atomic_load_n( cq_tail, __ATOMIC_ACQUIRE ) ){
+					io_uring_cqe& cqe = cqes[ head & *cq_mask ];
+					block = reinterpret_cast<IoBlock*>( uintptr_t( cqe.user_data ) );
+					result = cqe.res;
+					__atomic_store_n( cq_head, head + 1, __ATOMIC_RELEASE );
+					return true;
+				}
+				if( !submit( 1, IORING_ENTER_GETEVENTS ) )
+					return false;
+			}
+		}
+};
+#else
+class Uring{
+	public:
+		bool setup( unsigned ){ return false; }
+		bool write( int, IoBlock* ){ return false; }
+		bool wait( IoBlock*&, int& ){ return false; }
+};
+#endif
+
+
+bool syncPath( QString path ){
+	int file = ::open( path.toLocal8Bit().constData(), O_RDONLY );
+	if( file < 0 )
+		return false;
+	bool ok = fsync( file ) == 0;
+	return ::close( file ) == 0 && ok;
+}
+
+ReadAhead::~ReadAhead(){
+	if( reader.joinable() ){
+		{	lock_guard<mutex> guard( lock );
+			stopping = true;
+		}
+		changed.notify_all();
+		reader.join();
+	}
+	freeContext( context );
+	if( file >= 0 )
+		::close( file );
+	freeBlocks( blocks );
+}
+
+bool ReadAhead::open( QString path ){
+	if( !isLocalFile( path ) )
+		return false;
+	file = ::open( path.toLocal8Bit().constData(), O_RDONLY );
+	if( file < 0 )
+		return false;
+	
+	//Pipes and devices can't be read at arbitrary positions
+	struct stat info;
+	if( fstat( file, &info ) != 0 || !S_ISREG( info.st_mode ) )
+		return false;
+	file_size = info.st_size;
+	posix_fadvise( file, 0, 0, POSIX_FADV_SEQUENTIAL );
+	
+	if( !allocateBlocks( blocks, settings.blocks, settings.block_size ) )
+		return false;
+	auto buffer = static_cast<unsigned char*>( av_malloc( avio_buffer_size ) );
+	context = avio_alloc_context( buffer, avio_buffer_size, 0, this, &read, nullptr, &seek );
+	if( !context ){
+		av_freep( &buffer );
+		return false;
+	}
+	
+	reader = thread( [this](){ readLoop(); } );
+	return true;
+}
+
+void ReadAhead::readLoop(){
+	unique_lock<mutex> guard( lock );
+	while( true ){
+		changed.wait( guard, [this](){ return stopping || ( filled < blocks.size() && !end && !error ); } );
+		if( stopping )
+			return;
+		
+		//The free block isn't touched by the demuxer, so it can be filled
+		//without holding the lock
+		unsigned started = generation;
+		int64_t offset = fill_pos;
+		IoBlock& block = blocks[ (head + filled) % blocks.size() ];
+		guard.unlock();
+		delay( settings.latency );
+		int64_t amount = readFully( file, block.data, settings.block_size, offset );
+		guard.lock();
+		
+		if( started != generation )
+			continue; //Seeked away meanwhile
+		if( amount < 0 )
+			error = true;
+		else if( amount == 0 )
+			end = true;
+		else{
+			block.offset = offset;
+			block.used = amount;
+			fill_pos += amount;
+			filled++;
+		}
+		changed.notify_all();
+	}
+}
+
+int ReadAhead::read( void* opaque, uint8_t* buf, int size ){
+	auto self = static_cast<ReadAhead*>( opaque );
+	unique_lock<mutex> guard( self->lock );
+	self->changed.wait( guard, [self](){ return self->filled > 0 || self->end || self->error; } );
+	if( self->filled == 0 )
+		return self->error ? AVERROR( EIO ) : AVERROR_EOF;
+	
+	IoBlock& block = self->blocks[ self->head ];
+	size_t skip = self->position - block.offset;
+	size_t amount = min( size_t( size ), block.used - skip );
+	memcpy( buf, block.data + skip, amount );
+	self->position += amount;
+	
+	if( skip + amount == block.used ){
+		self->head = (self->head + 1) % self->blocks.size();
+		self->filled--;
+		self->changed.notify_all();
+	}
+	return amount;
+}
+
+int64_t ReadAhead::seek( void* opaque, int64_t offset, int whence ){
+	auto self = static_cast<ReadAhead*>( opaque );
+	if( whence & AVSEEK_SIZE )
+		return self->file_size;
+	
+	lock_guard<mutex> guard( self->lock );
+	int64_t target = seekTarget( offset, whence, self->position, self->file_size );
+	if( target < 0 )
+		return AVERROR( EINVAL );
+	
+	//Keep the blocks from target on, if it is in them
+	auto& blocks = self->blocks;
+	while( self->filled > 0 && blocks[ self->head ].offset + int64_t( blocks[ self->head ].used ) <= target ){
+		self->head = (self->head + 1) % blocks.size();
+		self->filled--;
+	}
+	bool buffered = self->filled > 0 && blocks[ self->head ].offset <= target;
+	if( !buffered && target != self->fill_pos ){
+		self->filled = 0;
+		self->fill_pos = target;
+		self->generation++;
+		self->end = false;
+		self->error = false;
+	}
+	self->position = target;
+	self->changed.notify_all();
+	return target;
+}
+
+
+WriteBehind::WriteBehind( const IoSettings& settings )
+	:	settings( settings )
+	,	free_blocks( max( settings.blocks, 2u ) )
+	,	queued( max( settings.blocks, 2u ) )
+	{ }
+
+WriteBehind::~WriteBehind(){
+	close();
+	freeContext( context );
+	freeBlocks( blocks );
+}
+
+bool WriteBehind::open( QString path ){
+	if( !isLocalFile( path ) )
+		return false;
+	file = ::open( path.toLocal8Bit().constData(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+	if( file < 0 )
+		return false;
+	
+	if( !allocateBlocks( blocks, settings.blocks, settings.block_size ) )
+		return false;
+	for( auto& block : blocks )
+		free_blocks.push( &block );
+	auto buffer = static_cast<unsigned char*>( av_malloc( avio_buffer_size ) );
+	context = avio_alloc_context( buffer, avio_buffer_size, 1, this, nullptr, &write, &seek );
+	if( !context ){
+		av_freep( &buffer );
+		return false;
+	}
+	
+	//The injected latency is done by the thread
+	ring.reset( new Uring() );
+	if( settings.latency > 0 || !ring->setup( blocks.size() ) ){
+		ring.reset();
+		writer = thread( [this](){ writeLoop(); } );
+	}
+	
+	current = acquire( 0 );
+	return true;
+}
+
+void WriteBehind::writeLoop(){
+	IoBlock* block;
+	while( queued.pop( block ) ){
+		delay( settings.latency );
+		if( !writeFully( file, block->data, block->used, block->offset ) )
+			failed = true;
+		free_blocks.push( block );
+		pending--;
+	}
+}
+
+void WriteBehind::complete(){
+	IoBlock* block;
+	int result;
+	if( !ring->wait( block, result ) ){
+		//Should not happen, but the blocks in flight are lost
+		failed = true;
+		pending = 0;
+		return;
+	}
+	
+	//Short writes are finished directly
+	if( result < 0 || !writeFully( file, block->data + result, block->used - result, block->offset + result ) )
+		failed = true;
+	free_blocks.push( block );
+	pending--;
+}
+
+void WriteBehind::drain(){
+	if( ring ){
+		while( pending > 0 )
+			complete();
+	}
+	else
+		while( pending > 0 )
+			this_thread::sleep_for( chrono::microseconds( 100 ) );
+}
+
+IoBlock* WriteBehind::acquire( int64_t offset ){
+	IoBlock* block;
+	if( ring ){
+		while( !free_blocks.tryPop( block ) )
+			complete();
+	}
+	else
+		free_blocks.pop( block );
+	block->offset = offset;
+	block->used = 0;
+	return block;
+}
+
+void WriteBehind::submit( IoBlock* block ){
+	if( block->used == 0 ){
+		free_blocks.push( block );
+		return;
+	}
+	
+	if( !ring ){
+		pending++;
+		queued.push( block );
+		return;
+	}
+	
+	//Writes in flight may complete in any order, so one going back over
+	//written data (the muxer updating a header) must wait for them
+	if( block->offset < submitted_end )
+		drain();
+	pending++;
+	submitted_end = max( submitted_end, block->offset + int64_t( block->used ) );
+	//The block stays in flight even if this fails, as the ring still has it.
+	//Writing it here too could race the kernel for the block
+	if( !ring->write( file, block ) )
+		failed = true;
+}
+
+int WriteBehind::write( void* opaque, uint8_t* buf, int size ){
+	auto self = static_cast<WriteBehind*>( opaque );
+	int left = size;
+	while( left > 0 ){
+		IoBlock*& block = self->current;
+		if( block->used == self->settings.block_size ){
+			int64_t next = block->offset + block->used;
+			self->submit( block );
+			block = self->acquire( next );
+		}
+		
+		size_t amount = min( size_t( left ), self->settings.block_size - block->used );
+		memcpy( block->data + block->used, buf, amount );
+		block->used += amount;
+		buf += amount;
+		left -= amount;
+	}
+	
+	self->size = max( self->size, self->current->offset + int64_t( self->current->used ) );
+	return self->failed ? AVERROR( EIO ) : size;
+}
+
+int64_t WriteBehind::seek( void* opaque, int64_t offset, int whence ){
+	auto self = static_cast<WriteBehind*>( opaque );
+	if( whence & AVSEEK_SIZE )
+		return self->size;
+	
+	int64_t position = self->current->offset + self->current->used;
+	int64_t target = seekTarget( offset, whence, position, self->size );
+	if( target < 0 )
+		return AVERROR( EINVAL );
+	
+	if( target != position ){
+		self->submit( self->current );
+		self->current = self->acquire( target );
+	}
+	return target;
+}
+
+bool WriteBehind::sync(){
+	if( !context )
+		return false;
+	
+	avio_flush( context );
+	int64_t next = current->offset + current->used;
+	submit( current );
+	current = acquire( next );
+	drain();
+	
+	//In the file is not yet on the disk
+	if( !failed && fsync( file ) != 0 )
+		failed = true;
+	return !failed;
+}
+
+bool WriteBehind::close(){
+	if( file < 0 )
+		return !failed;
+	
+	if( context )
+		sync();
+	if( writer.joinable() ){
+		queued.close();
+		writer.join();
+	}
+	ring.reset();
+	
+	if( ::close( file ) != 0 )
+		failed = true;
+	file = -1;
+	return !failed;
+}
@@ -0,0 +1,133 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASYNC_IO_HPP
+#define ASYNC_IO_HPP
+
+#include "ffmpeg.hpp"
+#include "Options.hpp"
+#include "BoundedQueue.hpp"
+
+#include <QString>
+
+#include <sys/uio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/* AVIOContexts doing the file access away from the threads using them, so
+ * slow storage doesn't stall the processing. ReadAhead reads large blocks
+ * ahead of the demuxer on a thread of its own, WriteBehind collects the
+ * muxer output into blocks written in the background, with io_uring when
+ * the kernel provides it and a thread otherwise.
+ * Only regular local files are handled, open() fails for anything else so
+ * the caller can fall back to the libavformat protocols. */
+
+///Flushes path to the disk, whichever descriptor wrote it. For directories
+///this makes the files created or renamed in them durable
+bool syncPath( QString path );
+
+///Page aligned buffer for one block of a file
+struct IoBlock{
+	uint8_t* data{ nullptr };
+	int64_t offset{ 0 }; ///Position in the file
+	size_t used{ 0 };    ///Bytes of data valid
+	iovec vec;           ///Kept alive for io_uring until the write completes
+};
+
+class ReadAhead{
+	private:
+		IoSettings settings;
+		int file{ -1 };
+		int64_t file_size{ 0 };
+		AVIOContext* context{ nullptr };
+		std::vector<IoBlock> blocks; ///Ring of blocks following position
+		
+		std::mutex lock;
+		std::condition_variable changed;
+		unsigned head{ 0 };       ///Block containing position
+		unsigned filled{ 0 };     ///Blocks ready from head on
+		int64_t position{ 0 };    ///Next byte for the demuxer
+		int64_t fill_pos{ 0 };    ///Next byte to read ahead
+		unsigned generation{ 0 }; ///Changed when a seek discards the blocks
+		bool end{ false }, error{ false }, stopping{ false };
+		std::thread reader;
+		
+		void readLoop();
+		static int read( void* opaque, uint8_t* buf, int size );
+		static int64_t seek( void* opaque, int64_t offset, int whence );
+		
+	public:
+		ReadAhead( const IoSettings& settings ) : settings( settings ) { }
+		ReadAhead( const ReadAhead& ) = delete;
+		~ReadAhead();
+		
+		bool open( QString path );
+		///For AVFormatContext::pb, valid until destroyed
+		AVIOContext* avio(){ return context; }
+};
+
+class Uring;
+
+class WriteBehind{
+	private:
+		IoSettings settings;
+		int file{ -1 };
+		AVIOContext* context{ nullptr };
+		std::vector<IoBlock> blocks;
+		BoundedQueue<IoBlock*> free_blocks;
+		BoundedQueue<IoBlock*> queued; ///For the writer thread
+		IoBlock* current{ nullptr };   ///Being filled by the muxer
+		int64_t size{ 0 };             ///End of the furthest write
+		int64_t submitted_end{ 0 };    ///Of the blocks given to io_uring
+		
+		std::atomic<unsigned> pending{ 0 }; ///Blocks not yet in the file
+		std::atomic<bool> failed{ false };
+		std::unique_ptr<Uring> ring;
+		std::thread writer;
+		
+		void writeLoop();
+		void complete();
+		void drain();
+		IoBlock* acquire( int64_t offset );
+		void submit( IoBlock* block );
+		static int write( void* opaque, uint8_t* buf, int size );
+		static int64_t seek( void* opaque, int64_t offset, int whence );
+		
+	public:
+		WriteBehind( const IoSettings& settings );
+		WriteBehind( const WriteBehind& ) = delete;
+		~WriteBehind();
+		
+		///Truncates path
+		bool open( QString path );
+		///For AVFormatContext::pb, valid until destroyed
+		AVIOContext* avio(){ return context; }
+		bool usesRing() const{ return ring != nullptr; }
+		
+		///Waits until everything written so far is in the file, false if
+		///any write failed
+		bool sync();
+		bool close();
+};
+
+#endif
@@ -0,0 +1,374 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Batch.hpp"
+#include "FrameProcessor.hpp"
+#include "Instrument.hpp"
+#include "VideoFile.hpp"
+#include "VideoFrame.hpp"
+#include "WorkPool.hpp"
+
+#include <QFile>
+#include <QStringList>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace{
+	const unsigned chunk_frames = 8; ///Decoded per task, before giving other files a turn
+}
+
+struct Batch::Slot{
+	VideoFrame frame;
+	FrameCorrection correction; ///Applied if processed
+	int64_t time{ AV_NOPTS_VALUE }; ///Of the decoded frame, AV_TIME_BASE units
+	int64_t sequence{ 0 };
+	bool processed{ false };
+	
+	Slot( unsigned width, unsigned height, unsigned head_switch, unsigned depth )
+		:	frame( width, height, head_switch, depth ) { }
+};
+
+struct Batch::Job{
+	QString input, output;
+	unsigned number{ 0 };
+	Options options;
+	EncodeSettings encode;
+	Callback done;
+	
+	unique_ptr<VideoFile> file;
+	unique_ptr<VideoEncode> encoder;
+	vector<VideoEncode*> encoders;
+	unique_ptr<FrameProcessor> processor;
+	ffmpeg::Frame decoded{ av_frame_alloc() };
+	int64_t start_pts{ AV_NOPTS_VALUE }, limit{ -1 }, total{ 0 };
+	size_t frame_size{ 0 };
+	unsigned share{ 0 };         ///Most frames this file may have in flight
+	chrono::steady_clock::time_point queued, start;
+	
+	//Guards the frames and the counters below
+	mutex lock;
+	vector<unique_ptr<Slot>> slots;
+	vector<Slot*> free_slots;
+	map<int64_t, Slot*> ready;   ///Processed, waiting for the earlier frames
+	int64_t decoded_count{ 0 };
+	int64_t encoded_count{ 0 };
+	bool parked{ false };        ///Decoding waits for a free frame
+	bool draining{ false };      ///A thread is encoding the ready frames
+	bool end{ false };
+	bool finished{ false };
+	bool released{ false };      ///Guarded by jobs_lock, nothing refers to it any more
+};
+
+Batch::Batch( unsigned threads ) : pool(threads), max_active(pool.size()) { }
+
+Batch::~Batch(){
+	wait();
+}
+
+unsigned Batch::add( QString input, QString output, const Options& options, const EncodeSettings& encode, Callback done ){
+	unique_ptr<Job> job( new Job() );
+	job->input = input;
+	job->output = output;
+	job->options = options;
+	job->encode = encode;
+	job->encode.path = output;
+	job->encode.io = options.io;
+	//Each file encodes on the thread draining it, so the pool is the only
+	//source of parallelism
+	job->encode.threads = 1;
+	job->done = done;
+	job->queued = chrono::steady_clock::now();
+	
+	unsigned number;
+	{	lock_guard<mutex> guard( jobs_lock );
+		prune();
+		number = job->number = ++added;
+		jobs.push_back( move( job ) );
+	}
+	startNext();
+	return number;
+}
+
+void Batch::wait(){
+	pool.wait();
+}
+
+unsigned Batch::waiting(){
+	lock_guard<mutex> guard( jobs_lock );
+	return jobs.size() - next_job;
+}
+
+unsigned Batch::running(){
+	lock_guard<mutex> guard( jobs_lock );
+	return active;
+}
+
+int Batch::run( const vector<pair<QString,QString>>& files, const Options& options, const EncodeSettings& encode ){
+	auto start = chrono::steady_clock::now();
+	for( auto& file : files )
+		add( file.first, file.second, options, encode );
+	wait();
+	double seconds = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+	
+	cout << "Batch done: " << completed << " files, " << failed << " failed, "
+		<< total_frames << " frames in " << seconds << "s ("
+		<< ( seconds > 0 ? total_frames / seconds : 0.0 ) << " fps)\n";
+	cout << "Threads: " << pool.size() << ", tasks stolen " << pool.steals()
+		<< ", peak frame memory " << peak_memory / (1024*1024) << " MB\n";
+	return failed > 0 ? 1 : 0;
+}
+
+///Drops the finished jobs, so a long running batch doesn't keep growing
+void Batch::prune(){
+	auto started = jobs.begin() + next_job;
+	auto kept = remove_if( jobs.begin(), started, []( const unique_ptr<Job>& job ){ return job->released; } );
+	next_job -= started - kept;
+	jobs.erase( kept, started );
+}
+
+void Batch::startNext(){
+	lock_guard<mutex> guard( jobs_lock );
+	while( active < max_active && next_job < jobs.size() ){
+		Job* job = jobs[next_job++].get();
+		active++;
+		pool.submit( [this,job](){
+				if( open( *job ) )
+					decode( job );
+				else
+					finish( job, false );
+			} );
+	}
+}
+
+bool Batch::open( Job& job ){
+	job.start = chrono::steady_clock::now();
+	job.file.reset( new VideoFile( job.input ) );
+	if( !job.file->open( job.options.io ) )
+		return false;
+	
+	job.encoder.reset( new VideoEncode( job.encode ) );
+	job.encoder->addPassthrough( job.file->formatContext(), job.file->streamIndex() );
+	auto format = VideoFrame::formatFor( job.file->depth() );
+	if( !job.encoder->open( job.file->frameRateQ(), job.file->width(), job.file->height(), format ) )
+		return false;
+	
+	job.encoders = { job.encoder.get() };
+	if( !job.file->startRange( job.encoders, job.options, job.start_pts, job.limit, job.total ) )
+		return false;
+	
+	job.processor.reset( new FrameProcessor( job.options ) );
+	job.frame_size = av_image_get_buffer_size( format, job.file->width(), job.file->height(), 32 );
+	job.share = max( size_t(2), job.options.max_memory / (job.frame_size * max_active) );
+	return true;
+}
+
+Batch::Slot* Batch::acquire( Job& job ){
+	if( !job.free_slots.empty() ){
+		auto slot = job.free_slots.back();
+		job.free_slots.pop_back();
+		return slot;
+	}
+	if( job.slots.size() >= job.share )
+		return nullptr;
+	
+	auto used = memory += job.frame_size;
+	auto peak = peak_memory.load();
+	while( used > peak && !peak_memory.compare_exchange_weak( peak, used ) ) { }
+	
+	job.slots.emplace_back( new Slot( job.file->width(), job.file->height(), job.options.head_switch, job.file->depth() ) );
+	return job.slots.back().get();
+}
+
+void Batch::decode( Job* job ){
+	for( unsigned i=0; i<chunk_frames; i++ ){
+		Slot* slot;
+		{	lock_guard<mutex> guard( job->lock );
+			slot = acquire( *job );
+			if( !slot ){
+				job->parked = true; //Resumed when a frame is encoded
+				return;
+			}
+		}
+		
+		bool got = job->decoded_count != job->limit && job->file->readFrame( job->decoded, job->encoders );
+		while( got && job->file->dropBeforeStart( job->decoded, job->start_pts ) )
+			got = job->file->readFrame( job->decoded, job->encoders );
+		
+		if( !got ){
+			bool done;
+			{	lock_guard<mutex> guard( job->lock );
+				job->free_slots.push_back( slot );
+				job->end = true;
+				done = !job->draining && !job->finished && job->encoded_count == job->decoded_count;
+				job->finished = job->finished || done;
+			}
+			if( done )
+				finish( job, true );
+			return;
+		}
+		
+		slot->time = job->file->frameTime( job->decoded );
+		{	INSTRUMENT_SCOPE( INIT );
+			slot->frame.initFrame( job->decoded );
+		}
+		{	lock_guard<mutex> guard( job->lock );
+			slot->sequence = job->decoded_count++;
+		}
+		
+		slot->processed = job->processor->prepare( slot->frame );
+		if( slot->processed )
+			pool.submit( [this,job,slot](){
+					slot->frame.analyse( slot->correction );
+					slot->frame.apply( slot->correction );
+					complete( job, slot );
+				} );
+		else
+			complete( job, slot );
+	}
+	
+	pool.submit( [this,job](){ decode( job ); } );
+}
+
+void Batch::complete( Job* job, Slot* slot ){
+	unique_lock<mutex> guard( job->lock );
+	job->ready[ slot->sequence ] = slot;
+	if( job->draining )
+		return; //Will be picked up by the thread draining
+	job->draining = true;
+	
+	//Encode in order, whichever thread finished the next frame
+	while( !job->ready.empty() && job->ready.begin()->first == job->encoded_count ){
+		auto next = job->ready.begin()->second;
+		job->ready.erase( job->ready.begin() );
+		guard.unlock();
+		
+		job->processor->finish( next->frame, next->processed, next->correction );
+		{	INSTRUMENT_SCOPE( ENCODE );
+			job->encoder->saveFrame( next->frame.getFrame(), next->time );
+		}
+		INSTRUMENT_COUNT( FRAMES, 1 );
+		
+		guard.lock();
+		job->encoded_count++;
+		job->free_slots.push_back( next );
+		if( job->parked ){
+			job->parked = false;
+			pool.submit( [this,job](){ decode( job ); } );
+		}
+	}
+	job->draining = false;
+	
+	bool done = job->end && !job->finished && job->encoded_count == job->decoded_count;
+	job->finished = job->finished || done;
+	guard.unlock();
+	if( done )
+		finish( job, true );
+}
+
+void Batch::finish( Job* job, bool ok ){
+	double seconds = chrono::duration<double>( chrono::steady_clock::now() - job->start ).count();
+	if( ok )
+		job->encoder->finish();
+	
+	{	lock_guard<mutex> guard( print_lock );
+		cout << "[" << job->number << "/" << added << "] " << job->input.toLocal8Bit().constData();
+		if( ok )
+			cout << ": " << job->encoded_count << " frames in " << seconds << "s ("
+				<< ( seconds > 0 ? job->encoded_count / seconds : 0.0 ) << " fps), "
+				<< job->processor->duplicateCount() << " duplicates\n";
+		else
+			cout << ": FAILED\n";
+	}
+	(ok ? completed : failed)++;
+	total_frames += job->encoded_count;
+	
+	Result result;
+	result.number = job->number;
+	result.input = job->input;
+	result.output = job->output;
+	result.ok = ok;
+	result.frames = job->encoded_count;
+	result.wait_seconds = chrono::duration<double>( job->start - job->queued ).count();
+	result.process_seconds = seconds;
+	
+	//Nothing refers to the job any more, so release the file and frames
+	memory -= job->slots.size() * job->frame_size;
+	job->slots.clear();
+	job->free_slots.clear();
+	job->processor.reset();
+	job->encoder.reset();
+	av_frame_unref( job->decoded.getFrame() );
+	job->file.reset();
+	
+	{	lock_guard<mutex> guard( jobs_lock );
+		active--;
+	}
+	if( job->done )
+		job->done( result );
+	{	lock_guard<mutex> guard( jobs_lock );
+		job->released = true;
+	}
+	startNext();
+}
+
+const char* unsupportedOption( const Options& options ){
+	if( options.preview > 0 )
+		return "--preview";
+	if( options.checkpoint > 0 )
+		return "--checkpoint";
+	if( options.resume )
+		return "--resume";
+	return nullptr;
+}
+
+int runBatch( QString list_path, const EncodeSettings& encode, const Options& options, unsigned threads ){
+	if( auto option = unsupportedOption( options ) ){
+		cout << option << " can't be used with --batch" << endl;
+		return -1;
+	}
+	
+	QFile list( list_path );
+	if( !list.open( QIODevice::ReadOnly ) ){
+		cout << "Could not read " << list_path.toLocal8Bit().constData() << endl;
+		return -1;
+	}
+	
+	vector<pair<QString,QString>> files;
+	for( auto line : QString::fromUtf8( list.readAll().constData() ).split( "\n" ) ){
+		if( line.trimmed().isEmpty() || line.startsWith( "#" ) )
+			continue;
+		auto parts = line.split( "\t" );
+		auto input = parts[0].trimmed();
+		files.push_back( { input, parts.size() > 1 ? parts[1].trimmed() : input + ".vhsfix.mkv" } );
+	}
+	if( files.empty() ){
+		cout << "No inputs in " << list_path.toLocal8Bit().constData() << endl;
+		return -1;
+	}
+	
+	Batch batch( threads );
+	return batch.run( files, options, encode );
+}
@@ -0,0 +1,113 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "Options.hpp"
+#include "VideoEncode.hpp"
+#include "WorkPool.hpp"
+
+#include <QString>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+/* Processes many inputs on one shared WorkPool. Each file is decoded in
+ * chunks of frames, every frame is processed as a separate task, and the
+ * results are put back in order for the file's own encoder. The frames in
+ * flight of all files share the memory budget in Options.
+ * Files can be added while others are running, so the pool can stay warm
+ * between jobs. */
+class Batch{
+	public:
+		struct Result{
+			unsigned number{ 0 };   ///Order the file was added in, from 1
+			QString input, output;
+			bool ok{ false };
+			int64_t frames{ 0 };
+			double wait_seconds{ 0.0 };    ///Queued before it was started
+			double process_seconds{ 0.0 };
+		};
+		typedef std::function<void( const Result& )> Callback;
+		
+	private:
+		struct Slot;
+		struct Job;
+		
+		WorkPool pool;
+		std::vector<std::unique_ptr<Job>> jobs;
+		unsigned max_active;
+		
+		std::mutex jobs_lock;
+		unsigned next_job{ 0 };
+		unsigned active{ 0 };
+		std::atomic<unsigned> added{ 0 };
+		
+		std::atomic<size_t> memory{ 0 };
+		std::atomic<size_t> peak_memory{ 0 };
+		std::atomic<unsigned> completed{ 0 }, failed{ 0 };
+		std::atomic<uint64_t> total_frames{ 0 };
+		std::mutex print_lock;
+		
+		void prune();
+		void startNext();
+		bool open( Job& job );
+		Slot* acquire( Job& job );
+		void decode( Job* job );
+		void complete( Job* job, Slot* slot );
+		void finish( Job* job, bool ok );
+		
+	public:
+		///threads of 0 uses one per core
+		Batch( unsigned threads );
+		~Batch();
+		
+		///Queues a file, done is called from a worker thread once it is finished.
+		///Returns the number the file was given
+		unsigned add( QString input, QString output, const Options& options, const EncodeSettings& encode, Callback done=nullptr );
+		///Blocks until every file added is finished
+		void wait();
+		
+		unsigned waiting();  ///Files not started yet
+		unsigned running();
+		unsigned completedCount() const{ return completed; }
+		unsigned failedCount() const{ return failed; }
+		unsigned threads() const{ return pool.size(); }
+		
+		///Processes files, printing the totals, returns the process exit code
+		int run( const std::vector<std::pair<QString,QString>>& files, const Options& options, const EncodeSettings& encode );
+};
+
+///The first option Batch doesn't implement, nullptr if it can run the jobs.
+///Checkpoints and previews need the single file path in main
+const char* unsupportedOption( const Options& options );
+
+/* Every line of the list is an input path, optionally followed by a tab and
+ * the output path. Without it the output is the input with ".vhsfix.mkv"
+ * appended. Empty lines and lines starting with '#' are skipped. */
+
+///encode is used for every output, threads of 0 uses one per core.
+///Returns the process exit code
+int runBatch( QString list, const EncodeSettings& encode, const Options& options, unsigned threads );
+
+#endif
@@ -0,0 +1,156 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <stdint.h>
+
+/* Lock-free bounded ring buffer, safe for any number of producers and
+ * consumers (sequence numbered cells). push() blocks while the queue is full
+ * and pop() while it is empty, and the time spent waiting is recorded so
+ * stalls in the pipeline can be reported. */
+template<typename T>
+class BoundedQueue{
+	private:
+		struct Cell{
+			std::atomic<size_t> sequence;
+			T data;
+		};
+		
+		std::unique_ptr<Cell[]> buffer;
+		size_t mask;
+		
+		//Padded so producers and consumers don't share cache lines
+		char padding1[64];
+		std::atomic<size_t> enqueue_pos{ 0 };
+		char padding2[64];
+		std::atomic<size_t> dequeue_pos{ 0 };
+		char padding3[64];
+		std::atomic<bool> closed{ false };
+		std::atomic<uint64_t> push_stall{ 0 };
+		std::atomic<uint64_t> pop_stall{ 0 };
+		
+		static size_t roundUp( size_t size ){
+			size_t result = 1;
+			while( result < size )
+				result *= 2;
+			return result;
+		}
+		
+		///Spins briefly, then yields, then sleeps
+		static void backoff( unsigned& attempt ){
+			if( attempt >= 128 )
+				std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+			else if( attempt >= 64 )
+				std::this_thread::yield();
+			attempt++;
+		}
+		
+		template<typename Wait>
+		static uint64_t waitUntil( Wait ready ){
+			if( ready() )
+				return 0;
+			
+			auto start = std::chrono::steady_clock::now();
+			unsigned attempt = 0;
+			do
+				backoff( attempt );
+			while( !ready() );
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start
+				).count();
+		}
+		
+	public:
+		///Capacity is rounded up to a power of two
+		BoundedQueue( size_t capacity )
+			:	buffer( new Cell[ roundUp( capacity ) ] ), mask( roundUp( capacity ) - 1 ) {
+			for( size_t i=0; i<=mask; i++ )
+				buffer[i].sequence.store( i, std::memory_order_relaxed );
+		}
+		
+		size_t capacity() const{ return mask + 1; }
+		
+		bool tryPush( const T& value ){
+			size_t pos = enqueue_pos.load( std::memory_order_relaxed );
+			while( true ){
+				Cell& cell = buffer[ pos & mask ];
+				size_t seq = cell.sequence.load( std::memory_order_acquire );
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if( diff == 0 ){
+					if( enqueue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ){
+						cell.data = value;
+						cell.sequence.store( pos + 1, std::memory_order_release );
+						return true;
+					}
+				}
+				else if( diff < 0 )
+					return false; //Full
+				else
+					pos = enqueue_pos.load( std::memory_order_relaxed );
+			}
+		}
+		
+		bool tryPop( T& value ){
+			size_t pos = dequeue_pos.load( std::memory_order_relaxed );
+			while( true ){
+				Cell& cell = buffer[ pos & mask ];
+				size_t seq = cell.sequence.load( std::memory_order_acquire );
+				intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+				if( diff == 0 ){
+					if( dequeue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ){
+						value = cell.data;
+						cell.sequence.store( pos + mask + 1, std::memory_order_release );
+						return true;
+					}
+				}
+				else if( diff < 0 )
+					return false; //Empty
+				else
+					pos = dequeue_pos.load( std::memory_order_relaxed );
+			}
+		}
+		
+		///Blocks while full
+		void push( const T& value ){
+			push_stall += waitUntil( [&](){ return tryPush( value ); } );
+		}
+		
+		///Blocks while empty, returns false once closed and drained
+		bool pop( T& value ){
+			bool got = false;
+			pop_stall += waitUntil( [&](){
+					got = tryPop( value );
+					return got || closed.load( std::memory_order_acquire );
+				} );
+			//Items pushed right before closing must still be delivered
+			return got || tryPop( value );
+		}
+		
+		///No more items will be pushed
+		void close(){ closed.store( true, std::memory_order_release ); }
+		
+		double pushStallMs() const{ return push_stall / 1e6; }
+		double popStallMs() const{ return pop_stall / 1e6; }
+};
+
+#endif
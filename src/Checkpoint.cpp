@@ -0,0 +1,120 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Checkpoint.hpp"
+#include "AsyncIO.hpp"
+
+#include <QFile>
+#include <QFileInfo>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+static const char checkpoint_magic[8] = { 'V', 'H', 'S', 'C', 'K', 'P', '0', '1' };
+
+Checkpoint::Checkpoint( const vector<QString>& outputs ) : outputs(outputs) {
+	if( !outputs.empty() )
+		path = outputs[0] + ".vhsresume";
+}
+
+bool Checkpoint::load(){
+	QFile f( path );
+	if( !f.open( QIODevice::ReadOnly ) )
+		return false;
+	
+	char magic[8];
+	int64_t count;
+	if( f.read( magic, sizeof(magic) ) != sizeof(magic) || !equal( magic, magic+8, checkpoint_magic ) )
+		return false;
+	if( f.read( (char*)&frame, sizeof(frame) ) != sizeof(frame)
+		|| f.read( (char*)&input_pos, sizeof(input_pos) ) != sizeof(input_pos)
+		|| f.read( (char*)&count, sizeof(count) ) != sizeof(count) )
+		return false;
+	if( count != int64_t(outputs.size()) ){
+		cout << "Checkpoint was made with " << count << " outputs, not " << outputs.size() << "\n";
+		return false;
+	}
+	
+	output_bytes.resize( count );
+	int64_t bytes = count * sizeof(int64_t);
+	return f.read( (char*)output_bytes.data(), bytes ) == bytes && frame > 0;
+}
+
+bool Checkpoint::save(){
+	//Once a later checkpoint exists the old partial outputs are not needed
+	if( resumed ){
+		for( auto& output : outputs )
+			QFile::remove( partialPath( output ) );
+		resumed = false;
+	}
+	
+	QString temp = path + ".tmp";
+	{	QFile f( temp );
+		if( !f.open( QIODevice::WriteOnly ) )
+			return false;
+		
+		int64_t count = output_bytes.size();
+		f.write( checkpoint_magic, sizeof(checkpoint_magic) );
+		f.write( (const char*)&frame, sizeof(frame) );
+		f.write( (const char*)&input_pos, sizeof(input_pos) );
+		f.write( (const char*)&count, sizeof(count) );
+		int64_t bytes = count * sizeof(int64_t);
+		if( f.write( (const char*)output_bytes.data(), bytes ) != bytes || !f.flush() || fsync( f.handle() ) != 0 )
+			return false;
+	}
+	
+	//The rename is only durable once the directory is synced too
+	if( std::rename( temp.toLocal8Bit().constData(), path.toLocal8Bit().constData() ) != 0 )
+		return false;
+	return syncPath( QFileInfo( path ).absolutePath() );
+}
+
+bool Checkpoint::setAside(){
+	for( unsigned i=0; i<outputs.size(); i++ ){
+		auto partial = partialPath( outputs[i] );
+		
+		//A partial output left by an earlier resume is still the one matching
+		//the checkpoint, as it is removed when the next one is saved
+		if( !QFile::exists( partial ) ){
+			if( QFile( outputs[i] ).size() < output_bytes[i] ){
+				cout << "Output " << outputs[i].toLocal8Bit().constData() << " is shorter than the checkpoint\n";
+				return false;
+			}
+			if( !QFile::rename( outputs[i], partial ) ){
+				cout << "Could not move " << outputs[i].toLocal8Bit().constData() << " aside\n";
+				return false;
+			}
+		}
+		else if( QFile( partial ).size() < output_bytes[i] ){
+			cout << "Output " << partial.toLocal8Bit().constData() << " is shorter than the checkpoint\n";
+			return false;
+		}
+	}
+	resumed = true;
+	return true;
+}
+
+void Checkpoint::remove(){
+	QFile::remove( path );
+	for( auto& output : outputs )
+		QFile::remove( partialPath( output ) );
+}
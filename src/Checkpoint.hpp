@@ -0,0 +1,57 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <QString>
+
+#include <stdint.h>
+#include <vector>
+
+/* Progress of a run that can be resumed after a crash, stored next to the
+ * first output as "<output>.vhsresume". Checkpoints are taken where every
+ * output starts a new GOP, so everything before frame is complete. On
+ * resume the outputs are moved to "<output>.partial" and copied up to the
+ * checkpoint before encoding continues. */
+class Checkpoint{
+	private:
+		QString path;
+		std::vector<QString> outputs;
+		bool resumed{ false }; ///The partial outputs are still needed
+		
+	public:
+		int64_t frame{ 0 };      ///Frames of the range that are complete in every output
+		int64_t input_pos{ -1 }; ///Input byte position of the keyframe to decode from
+		std::vector<int64_t> output_bytes; ///Size of each output up to frame
+		
+		Checkpoint( const std::vector<QString>& outputs );
+		
+		static QString partialPath( QString output ){ return output + ".partial"; }
+		QString partialOutput( unsigned i ) const{ return partialPath( outputs[i] ); }
+		
+		bool load();
+		///Written to a temporary file first, so a crash leaves the old one
+		bool save();
+		///Moves the outputs aside so they can be copied up to frame.
+		///Returns false if they don't contain the checkpoint
+		bool setAside();
+		///The run has finished, removes the checkpoint and partial outputs
+		void remove();
+};
+
+#endif
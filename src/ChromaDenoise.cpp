@@ -0,0 +1,88 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ChromaDenoise.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+ChromaDenoise::ChromaDenoise( unsigned length, int threshold )
+	:	max_length( max( 1u, length ) ), max_threshold( threshold )
+	,	length( max_length ), threshold( threshold ) { }
+
+void ChromaDenoise::reset( unsigned width, unsigned height, unsigned depth ){
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	length = min( max_length, 0xFFFFu / ((1u << depth) - 1) );
+	threshold = max_threshold << (depth - 8);
+	
+	unsigned bytes = depth > 8 ? 2 : 1;
+	count = next = 0;
+	history.assign( size_t(length) * 2 * width * height * bytes, 0 );
+	sums.assign( 2 * width * height, 0 );
+}
+
+///Branch free, so the compiler can vectorize it
+template<typename Sample>
+static void denoiseRow( Sample* row, Sample* oldest, uint16_t* sum, unsigned width, uint32_t reciprocal, int threshold ){
+	for( unsigned ix=0; ix<width; ix++ ){
+		int current = row[ix];
+		sum[ix] += current - oldest[ix];
+		oldest[ix] = current;
+		
+		int average = ( sum[ix] * reciprocal + (1 << 15) ) >> 16;
+		row[ix] = abs( current - average ) <= threshold ? average : current;
+	}
+}
+
+template<typename Sample>
+void ChromaDenoise::denoise( ffmpeg::Frame& frame, uint8_t* slot, uint32_t reciprocal ){
+	auto av_frame = frame.getFrame();
+	auto oldest = reinterpret_cast<Sample*>( slot );
+	for( int p=0; p<2; p++ )
+		for( unsigned iy=0; iy<height; iy++ ){
+			size_t offset = ( p * height + iy ) * width;
+			denoiseRow( reinterpret_cast<Sample*>( av_frame->data[p+1] + iy * av_frame->linesize[p+1] )
+				,	oldest + offset, sums.data() + offset, width, reciprocal, threshold );
+		}
+}
+
+void ChromaDenoise::process( ffmpeg::Frame& frame ){
+	auto plane = frame.getPlane( 1 );
+	if( plane.getWidth() != width || plane.getHeight() != height || frame.depth() != depth )
+		reset( plane.getWidth(), plane.getHeight(), frame.depth() );
+	
+	//The slot being replaced holds the oldest frame, or nothing yet
+	size_t slot_size = history.size() / length;
+	uint8_t* slot = history.data() + next * slot_size;
+	if( count < length ){
+		memset( slot, 0, slot_size );
+		count++;
+	}
+	uint32_t reciprocal = ( (1 << 16) + count/2 ) / count;
+	
+	if( depth > 8 )
+		denoise<uint16_t>( frame, slot, reciprocal );
+	else
+		denoise<uint8_t>( frame, slot, reciprocal );
+	
+	next = (next + 1) % length;
+}
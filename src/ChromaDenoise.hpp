@@ -0,0 +1,61 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHROMA_DENOISE_HPP
+#define CHROMA_DENOISE_HPP
+
+#include "ffmpeg.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+/* Temporal noise reduction of the chroma planes. Keeps the chroma of the last
+ * frames in a ring buffer together with a running sum per pixel, so the
+ * average costs the same whatever the amount of frames. Pixels which differ
+ * too much from the average are considered motion and left alone.
+ * The chroma is copied into the ring while the frame is denoised, in the same
+ * pass. The frames can't serve as the history themselves: they are denoised
+ * in place, while the sums need the values from before, and the slots and
+ * decoded buffers are reused as soon as the frame has been encoded. */
+class ChromaDenoise{
+	private:
+		unsigned max_length;
+		int max_threshold;
+		unsigned length;      ///Limited so the sums fit for the depth
+		int threshold;        ///Scaled to the depth
+		
+		unsigned width{ 0 };  ///Of one chroma plane
+		unsigned height{ 0 };
+		unsigned depth{ 0 };
+		unsigned count{ 0 };  ///Frames in the ring
+		unsigned next{ 0 };   ///Slot to overwrite
+		std::vector<uint8_t> history; ///Samples of the frame depth
+		std::vector<uint16_t> sums;
+		
+		void reset( unsigned width, unsigned height, unsigned depth );
+		template<typename Sample>
+		void denoise( ffmpeg::Frame& frame, uint8_t* slot, uint32_t reciprocal );
+		
+	public:
+		///length is limited to 256 frames at 8 bit and 64 at 10 bit, so the
+		///sums fit in 16 bit. threshold is in 8 bit units
+		ChromaDenoise( unsigned length, int threshold );
+		
+		void process( ffmpeg::Frame& frame );
+};
+
+#endif
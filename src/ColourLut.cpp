@@ -0,0 +1,254 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ColourLut.hpp"
+
+#include <QFile>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+namespace{
+	const int weight_bits = 12;
+	const int32_t weight_one = 1 << weight_bits;
+}
+
+bool ColourLut::loadCube( QString path ){
+	auto name = path.toLocal8Bit();
+	QFile f( path );
+	if( !f.open( QIODevice::ReadOnly ) ){
+		cout << "Could not open LUT " << name.constData() << endl;
+		return false;
+	}
+	
+	istringstream stream( f.readAll().constData() );
+	unsigned new_size = 0;
+	vector<float> values;
+	float new_min[3]{ 0.0f, 0.0f, 0.0f };
+	float new_max[3]{ 1.0f, 1.0f, 1.0f };
+	string line;
+	while( getline( stream, line ) ){
+		istringstream words( line );
+		string key;
+		if( !(words >> key) || key[0] == '#' )
+			continue;
+		
+		if( key == "LUT_3D_SIZE" )
+			words >> new_size;
+		else if( key == "DOMAIN_MIN" )
+			words >> new_min[0] >> new_min[1] >> new_min[2];
+		else if( key == "DOMAIN_MAX" )
+			words >> new_max[0] >> new_max[1] >> new_max[2];
+		else if( key == "LUT_1D_SIZE" ){
+			cout << name.constData() << " is a 1D LUT, only 3D LUTs are supported" << endl;
+			return false;
+		}
+		else if( isdigit( key[0] ) || key[0] == '-' || key[0] == '.' ){
+			istringstream numbers( line );
+			float r, g, b;
+			if( !(numbers >> r >> g >> b) ){
+				cout << name.constData() << ": invalid line \"" << line << "\"" << endl;
+				return false;
+			}
+			values.push_back( r );
+			values.push_back( g );
+			values.push_back( b );
+		}
+		//TITLE and other keywords don't matter here
+	}
+	
+	if( new_size < 2 || new_size > 256 || values.size() != size_t(new_size) * new_size * new_size * 3 ){
+		cout << name.constData() << " doesn't contain a valid 3D LUT" << endl;
+		return false;
+	}
+	for( int c=0; c<3; c++ )
+		if( new_max[c] <= new_min[c] ){
+			cout << name.constData() << " has an empty domain" << endl;
+			return false;
+		}
+	
+	cube_size = new_size;
+	cube = values;
+	copy( new_min, new_min + 3, domain_min );
+	copy( new_max, new_max + 3, domain_max );
+	depth = 0;
+	return true;
+}
+
+void ColourLut::generate( const double lift[3], const double gamma[3], const double gain[3] ){
+	cube_size = 33;
+	cube.resize( cube_size * cube_size * cube_size * 3 );
+	fill( domain_min, domain_min + 3, 0.0f );
+	fill( domain_max, domain_max + 3, 1.0f );
+	
+	for( unsigned ib=0; ib<cube_size; ib++ )
+		for( unsigned ig=0; ig<cube_size; ig++ )
+			for( unsigned ir=0; ir<cube_size; ir++ ){
+				unsigned index[3]{ ir, ig, ib };
+				float* out = &cube[ ((ib * cube_size + ig) * cube_size + ir) * 3 ];
+				for( int c=0; c<3; c++ ){
+					double in = index[c] / double(cube_size - 1);
+					double lifted = gain[c] * (in + lift[c] * (1.0 - in));
+					out[c] = pow( max( lifted, 0.0 ), 1.0 / gamma[c] );
+				}
+			}
+	depth = 0;
+}
+
+void ColourLut::sampleCube( const double in[3], double out[3] ) const{
+	unsigned last = cube_size - 1;
+	unsigned index[3];
+	double frac[3];
+	for( int c=0; c<3; c++ ){
+		double t = (in[c] - domain_min[c]) / (domain_max[c] - domain_min[c]);
+		double pos = min( max( t, 0.0 ), 1.0 ) * last;
+		index[c] = min( unsigned( pos ), last - 1 );
+		frac[c] = pos - index[c];
+	}
+	
+	//Trilinear, only used for resampling
+	fill( out, out + 3, 0.0 );
+	for( int corner=0; corner<8; corner++ ){
+		double weight = 1.0;
+		size_t at = 0, stride = 1;
+		for( int axis=0; axis<3; axis++ ){
+			unsigned upper = (corner >> axis) & 1;
+			weight *= upper ? frac[axis] : 1.0 - frac[axis];
+			at += (index[axis] + upper) * stride;
+			stride *= cube_size;
+		}
+		for( int c=0; c<3; c++ )
+			out[c] += weight * cube[at * 3 + c];
+	}
+}
+
+void ColourLut::precompute( unsigned depth ){
+	this->depth = depth;
+	size = cube_size <= 17 ? 17 : 33;
+	int max_value = (1 << depth) - 1;
+	double k = 1 << (depth - 8); //BT.601 limited range, scaled to the depth
+	
+	lattice.resize( size * size * size );
+	for( unsigned iy=0; iy<size; iy++ )
+		for( unsigned iu=0; iu<size; iu++ )
+			for( unsigned iv=0; iv<size; iv++ ){
+				double y = (iy * max_value / double(size - 1) - 16 * k) / (219 * k);
+				double u = (iu * max_value / double(size - 1) - 128 * k) / (224 * k);
+				double v = (iv * max_value / double(size - 1) - 128 * k) / (224 * k);
+				double rgb[3]{ y + 1.402 * v, y - 0.344136 * u - 0.714136 * v, y + 1.772 * u };
+				
+				//Out of gamut colours keep their distance to it, so an
+				//identity LUT changes nothing
+				double clamped[3], graded[3];
+				for( int c=0; c<3; c++ )
+					clamped[c] = min( max( rgb[c], 0.0 ), 1.0 );
+				sampleCube( clamped, graded );
+				for( int c=0; c<3; c++ )
+					graded[c] += rgb[c] - clamped[c];
+				
+				double gy = 0.299 * graded[0] + 0.587 * graded[1] + 0.114 * graded[2];
+				double out[3]{
+						16 * k + 219 * k * gy
+					,	128 * k + 224 * k * (graded[2] - gy) / 1.772
+					,	128 * k + 224 * k * (graded[0] - gy) / 1.402
+					};
+				Entry& entry = lattice[ (iy * size + iu) * size + iv ];
+				for( int c=0; c<3; c++ )
+					entry[c] = min( max( int( lround( out[c] ) ), 0 ), max_value );
+				entry[3] = 0;
+			}
+	
+	unsigned strides[3]{ size * size, size, 1 };
+	for( int a=0; a<3; a++ ){
+		axes[a].resize( max_value + 1 );
+		for( int value=0; value<=max_value; value++ ){
+			unsigned scaled = value * (size - 1);
+			unsigned index = min( scaled / max_value, size - 2 );
+			axes[a][value].offset = index * strides[a];
+			axes[a][value].weight = ( (scaled - index * max_value) * weight_one + max_value / 2 ) / max_value;
+		}
+	}
+}
+
+inline ColourLut::Entry ColourLut::interpolate( const Axis& y, const Axis& u, const Axis& v ) const{
+	const Entry* base = lattice.data() + y.offset + u.offset + v.offset;
+	
+	//The order of the weights selects the tetrahedron around the point
+	int32_t w0 = y.weight, w1 = u.weight, w2 = v.weight;
+	uint32_t s0 = size * size, s1 = size, s2 = 1;
+	if( w0 < w1 ){ swap( w0, w1 ); swap( s0, s1 ); }
+	if( w1 < w2 ){ swap( w1, w2 ); swap( s1, s2 ); }
+	if( w0 < w1 ){ swap( w0, w1 ); swap( s0, s1 ); }
+	
+	Entry sum = base[0] * (weight_one - w0)
+		+	base[s0] * (w0 - w1)
+		+	base[s0 + s1] * (w1 - w2)
+		+	base[s0 + s1 + s2] * w2;
+	return (sum + weight_one / 2) >> weight_bits;
+}
+
+template<typename Sample>
+void ColourLut::grade( ffmpeg::Frame& frame ){
+	auto av_frame = frame.getFrame();
+	unsigned max_value = (1u << depth) - 1;
+	auto sample = [&]( int plane, unsigned y ){
+		return reinterpret_cast<Sample*>( av_frame->data[plane] + y * av_frame->linesize[plane] );
+	};
+	
+	for( unsigned cy=0; cy<frame.height()/2; cy++ ){
+		Sample* rows[2]{ sample( 0, cy*2 ), sample( 0, cy*2+1 ) };
+		Sample* u_row = sample( 1, cy );
+		Sample* v_row = sample( 2, cy );
+		
+		for( unsigned cx=0; cx<frame.width()/2; cx++ ){
+			const Axis& u = axes[1][ min( unsigned( u_row[cx] ), max_value ) ];
+			const Axis& v = axes[2][ min( unsigned( v_row[cx] ), max_value ) ];
+			
+			//The chroma gets the average of its four luma pixels
+			Entry chroma{ 0, 0, 0, 0 };
+			for( int dy=0; dy<2; dy++ )
+				for( int dx=0; dx<2; dx++ ){
+					Sample& luma = rows[dy][cx*2 + dx];
+					Entry graded = interpolate( axes[0][ min( unsigned( luma ), max_value ) ], u, v );
+					luma = graded[0];
+					chroma += graded;
+				}
+			u_row[cx] = (chroma[1] + 2) >> 2;
+			v_row[cx] = (chroma[2] + 2) >> 2;
+		}
+	}
+}
+
+void ColourLut::process( ffmpeg::Frame& frame ){
+	if( cube.empty() )
+		return;
+	if( frame.format() != AV_PIX_FMT_YUV420P && frame.format() != AV_PIX_FMT_YUV420P10 )
+		return;
+	
+	if( frame.depth() != depth )
+		precompute( frame.depth() );
+	if( depth > 8 )
+		grade<uint16_t>( frame );
+	else
+		grade<uint8_t>( frame );
+}
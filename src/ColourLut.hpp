@@ -0,0 +1,72 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COLOUR_LUT_HPP
+#define COLOUR_LUT_HPP
+
+#include "ffmpeg.hpp"
+
+#include <QString>
+
+#include <stdint.h>
+#include <vector>
+
+/* Colour grading with a 3D LUT, loaded from a .cube file or generated from
+ * lift, gamma and gain. The LUT works on RGB, so it is resampled once into
+ * a lattice over the YUV values of the frame depth, and every pixel is then
+ * a tetrahedral interpolation in that lattice. The three channels of a
+ * lattice point are kept in one vector, so each interpolation step is a
+ * single SIMD operation. Chroma of the 4:2:0 frames is graded together
+ * with the four luma pixels it belongs to and averaged back. */
+class ColourLut{
+	public:
+		typedef int32_t Entry __attribute__(( vector_size( 16 ) )); ///Y, U, V and padding
+		
+	private:
+		///Lattice coordinate of a sample value
+		struct Axis{
+			uint32_t offset; ///Of the lower lattice point, in entries
+			int32_t weight;  ///Of the upper one, 0 to 4096
+		};
+		
+		//The RGB LUT, red changing fastest
+		unsigned cube_size{ 0 };
+		std::vector<float> cube;
+		float domain_min[3]{ 0.0f, 0.0f, 0.0f };
+		float domain_max[3]{ 1.0f, 1.0f, 1.0f };
+		
+		unsigned depth{ 0 };
+		unsigned size{ 0 }; ///Lattice points along each axis
+		std::vector<Entry> lattice;
+		std::vector<Axis> axes[3];
+		
+		void sampleCube( const double in[3], double out[3] ) const;
+		void precompute( unsigned depth );
+		Entry interpolate( const Axis& y, const Axis& u, const Axis& v ) const;
+		template<typename Sample> void grade( ffmpeg::Frame& frame );
+		
+	public:
+		///Prints the problem and returns false if path isn't a valid .cube
+		bool loadCube( QString path );
+		///Per RGB channel, as out = (gain * (in + lift * (1 - in)))^(1 / gamma)
+		void generate( const double lift[3], const double gamma[3], const double gain[3] );
+		
+		///Only 8 and 10 bit 4:2:0
+		void process( ffmpeg::Frame& frame );
+};
+
+#endif
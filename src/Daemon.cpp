@@ -0,0 +1,401 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Daemon.hpp"
+#include "Arguments.hpp"
+#include "Batch.hpp"
+#include "ColourLut.hpp"
+
+#include <QDir>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace{
+	const size_t max_request = 64 * 1024;
+	const int request_timeout = 5; ///Seconds a client may take to send its request
+	
+	///Connection to one client, closed once the last reference is gone
+	class Connection{
+		private:
+			int fd;
+			mutex lock;
+			string received; ///Of the request, until it is complete
+			
+		public:
+			const chrono::steady_clock::time_point deadline; ///For the request
+			
+			Connection( int fd )
+				:	fd(fd), deadline( chrono::steady_clock::now() + chrono::seconds( request_timeout ) ) { }
+			~Connection(){ close( fd ); }
+			
+			int handle() const{ return fd; }
+			
+			///Replies are sent in the order of the calls, hold() delays them
+			unique_lock<mutex> hold(){ return unique_lock<mutex>( lock ); }
+			void reply( const string& line ){
+				lock_guard<mutex> guard( lock );
+				write( line );
+			}
+			
+			///The lock must be held. The client might have gone away, which
+			///only loses the reply
+			void write( const string& line ){
+				string data = line + "\n";
+				for( size_t sent=0; sent<data.size(); ){
+					auto amount = send( fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL );
+					if( amount < 0 && errno == EINTR )
+						continue;
+					if( amount <= 0 )
+						return;
+					sent += amount;
+				}
+			}
+			
+			///Reads what has arrived of the NUL terminated strings ending with an
+			///empty one, without waiting for more. done is set once the request
+			///is complete, false is returned if it never can be
+			bool readRequest( QStringList& parts, bool& done ){
+				char data[4096];
+				done = false;
+				while( received.size() < max_request ){
+					auto amount = recv( fd, data, sizeof(data), MSG_DONTWAIT );
+					if( amount < 0 && errno == EINTR )
+						continue;
+					if( amount < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+						return true;
+					if( amount <= 0 )
+						return false;
+					received.append( data, amount );
+					
+					parts = QStringList();
+					size_t pos = 0;
+					for( size_t end; (end = received.find( '\0', pos )) != string::npos; pos = end + 1 ){
+						if( end == pos ){
+							done = true;
+							return true;
+						}
+						parts.append( QString::fromLocal8Bit( received.substr( pos, end - pos ).c_str() ) );
+					}
+				}
+				return false;
+			}
+	};
+	
+	bool makeAddress( QString path, sockaddr_un& address ){
+		auto bytes = path.toLocal8Bit();
+		memset( &address, 0, sizeof(address) );
+		address.sun_family = AF_UNIX;
+		if( bytes.size() <= 0 || size_t(bytes.size()) >= sizeof(address.sun_path) ){
+			cout << "Socket path too long: " << bytes.constData() << endl;
+			return false;
+		}
+		memcpy( address.sun_path, bytes.constData(), bytes.size() );
+		return true;
+	}
+	
+	int connectTo( const sockaddr_un& address ){
+		int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+		if( fd < 0 )
+			return -1;
+		if( connect( fd, (const sockaddr*)&address, sizeof(address) ) != 0 ){
+			close( fd );
+			return -1;
+		}
+		return fd;
+	}
+	
+	string queueState( Batch& batch ){
+		stringstream ss;
+		ss << batch.waiting() << " waiting, " << batch.running() << " running";
+		return ss.str();
+	}
+	
+	///Parses a job on top of the daemon defaults, with paths relative to cwd
+	bool parseJob( const QStringList& args, const QDir& cwd, Options& options, EncodeSettings& encode, QString& input, QString& output, string& error ){
+		QString default_lut = options.lut; //Already relative to the daemon
+		for( int i=0; i<args.size(); i++ ){
+			bool valid = true;
+			if( parseOption( args, i, options, encode, &valid ) ){
+				if( !valid ){
+					error = "invalid value for " + string( args[i-1].toLocal8Bit().constData() );
+					return false;
+				}
+			}
+			else if( args[i].startsWith( "--" ) ){
+				error = "unknown option " + string( args[i].toLocal8Bit().constData() );
+				return false;
+			}
+			else if( input.isEmpty() )
+				input = cwd.absoluteFilePath( args[i] );
+			else if( output.isEmpty() )
+				output = cwd.absoluteFilePath( args[i] );
+			else{
+				error = "one input and one output per job";
+				return false;
+			}
+		}
+		
+		if( input.isEmpty() ){
+			error = "no input";
+			return false;
+		}
+		if( output.isEmpty() )
+			output = input + ".vhsfix.mkv";
+		if( auto option = unsupportedOption( options ) ){
+			error = string( option ) + " can't be used for daemon jobs";
+			return false;
+		}
+		
+		if( !options.lut.isEmpty() && options.lut != default_lut ){
+			options.lut = cwd.absoluteFilePath( options.lut );
+			if( !ColourLut().loadCube( options.lut ) ){
+				error = "could not load LUT";
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+int runDaemon( QString socket_path, unsigned threads, const Options& options, const EncodeSettings& encode ){
+	if( auto option = unsupportedOption( options ) ){
+		cout << option << " can't be used with --daemon" << endl;
+		return -1;
+	}
+	
+	sockaddr_un address;
+	if( !makeAddress( socket_path, address ) )
+		return -1;
+	
+	//A socket left by a daemon that died can be replaced, a live one not
+	int existing = connectTo( address );
+	if( existing >= 0 ){
+		close( existing );
+		cout << "A daemon is already running on " << address.sun_path << endl;
+		return -1;
+	}
+	unlink( address.sun_path );
+	
+	int server = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+	if( server < 0
+		||	bind( server, (const sockaddr*)&address, sizeof(address) ) != 0
+		||	listen( server, 64 ) != 0
+		){
+		cout << "Could not listen on " << address.sun_path << ": " << strerror( errno ) << endl;
+		if( server >= 0 )
+			close( server );
+		return -1;
+	}
+	
+	mutex log_lock;
+	Batch batch( threads );
+	cout << "Listening on " << address.sun_path << " with " << batch.threads() << " threads" << endl;
+	
+	//Requests are read as they arrive, so a slow client doesn't hold up the
+	//others. Each is handled once complete, queueing a job doesn't block
+	bool stopping = false;
+	auto handle = [&]( shared_ptr<Connection> client, const QStringList& request ){
+		if( request.isEmpty() ){
+			client->reply( "error: incomplete request" );
+			return;
+		}
+		QDir cwd( request[0] );
+		QStringList args = request.mid( 1 );
+		
+		if( args.size() == 1 && args[0] == "--status" ){
+			stringstream ss;
+			ss << "status: " << queueState( batch ) << ", "
+				<< batch.completedCount() << " done, " << batch.failedCount() << " failed";
+			client->reply( ss.str() );
+			return;
+		}
+		if( args.size() == 1 && args[0] == "--stop" ){
+			client->reply( "stopping, " + queueState( batch ) );
+			stopping = true;
+			return;
+		}
+		
+		Options job_options = options;
+		EncodeSettings job_encode = encode;
+		QString input, output;
+		string error;
+		if( !parseJob( args, cwd, job_options, job_encode, input, output, error ) ){
+			client->reply( "error: " + error );
+			return;
+		}
+		
+		//Hold the replies back until the job is queued, as it may finish first
+		auto replies = client->hold();
+		auto number = batch.add( input, output, job_options, job_encode, [client,&batch,&log_lock]( const Batch::Result& result ){
+				double latency = result.wait_seconds + result.process_seconds;
+				string state = queueState( batch );
+				{	lock_guard<mutex> guard( log_lock );
+					cout << "Job " << result.number << ( result.ok ? "" : " failed" )
+						<< ": latency " << latency << "s (waited " << result.wait_seconds << "s), "
+						<< state << endl;
+				}
+				
+				stringstream ss;
+				if( result.ok )
+					ss << "done " << result.number << ": " << result.frames << " frames, waited "
+						<< result.wait_seconds << "s, processed " << result.process_seconds
+						<< "s, latency " << latency << "s";
+				else
+					ss << "failed " << result.number << ": " << result.input.toLocal8Bit().constData();
+				client->reply( ss.str() );
+			} );
+		string state = queueState( batch );
+		stringstream ss;
+		ss << "queued " << number << ", " << state;
+		client->write( ss.str() );
+		replies.unlock();
+		
+		{	lock_guard<mutex> guard( log_lock );
+			cout << "Job " << number << " queued: " << input.toLocal8Bit().constData() << ", " << state << endl;
+		}
+	};
+	
+	vector<shared_ptr<Connection>> pending; ///In the order accepted, so by deadline
+	while( !stopping ){
+		int wait = -1;
+		if( !pending.empty() ){
+			auto left = chrono::duration_cast<chrono::milliseconds>( pending[0]->deadline - chrono::steady_clock::now() );
+			wait = max( 0, int( left.count() ) + 1 );
+		}
+		
+		vector<pollfd> fds( 1 + pending.size() );
+		fds[0] = { server, POLLIN, 0 };
+		for( unsigned i=0; i<pending.size(); i++ )
+			fds[i+1] = { pending[i]->handle(), POLLIN, 0 };
+		if( poll( fds.data(), fds.size(), wait ) < 0 ){
+			if( errno == EINTR )
+				continue;
+			cout << "Waiting for clients failed: " << strerror( errno ) << endl;
+			break;
+		}
+		
+		auto now = chrono::steady_clock::now();
+		vector<shared_ptr<Connection>> still_pending;
+		for( unsigned i=0; i<pending.size() && !stopping; i++ ){
+			auto& client = pending[i];
+			QStringList request;
+			bool done = false;
+			if( fds[i+1].revents && !client->readRequest( request, done ) )
+				client->reply( "error: incomplete request" );
+			else if( done )
+				handle( client, request );
+			else if( now >= client->deadline )
+				client->reply( "error: incomplete request" );
+			else
+				still_pending.push_back( client );
+		}
+		pending.swap( still_pending );
+		
+		if( fds[0].revents && !stopping ){
+			int fd = accept4( server, nullptr, nullptr, SOCK_CLOEXEC );
+			if( fd >= 0 )
+				pending.push_back( make_shared<Connection>( fd ) );
+			else if( errno != EINTR && errno != ECONNABORTED && errno != EAGAIN ){
+				cout << "Accepting failed: " << strerror( errno ) << endl;
+				break;
+			}
+		}
+	}
+	
+	close( server );
+	batch.wait();
+	unlink( address.sun_path );
+	cout << "Stopped after " << batch.completedCount() << " jobs, " << batch.failedCount() << " failed" << endl;
+	return 0;
+}
+
+int runClient( QString socket_path, const QStringList& args ){
+	sockaddr_un address;
+	if( !makeAddress( socket_path, address ) )
+		return -1;
+	
+	int fd = connectTo( address );
+	if( fd < 0 ){
+		cout << "No daemon running on " << address.sun_path << endl;
+		return -1;
+	}
+	
+	string request;
+	char cwd[4096];
+	if( !getcwd( cwd, sizeof(cwd) ) )
+		cwd[0] = '/', cwd[1] = 0;
+	request.append( cwd, strlen( cwd ) + 1 );
+	for( auto& arg : args ){
+		auto bytes = arg.toLocal8Bit();
+		request.append( bytes.constData(), bytes.size() + 1 );
+	}
+	request.push_back( '\0' );
+	
+	for( size_t sent=0; sent<request.size(); ){
+		auto amount = send( fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL );
+		if( amount < 0 && errno == EINTR )
+			continue;
+		if( amount <= 0 ){
+			cout << "Could not send the job: " << strerror( errno ) << endl;
+			close( fd );
+			return -1;
+		}
+		sent += amount;
+	}
+	
+	//Print the replies until the daemon closes the connection
+	string last, line;
+	char data[4096];
+	ssize_t amount;
+	while( (amount = recv( fd, data, sizeof(data), 0 )) != 0 ){
+		if( amount < 0 ){
+			if( errno == EINTR )
+				continue;
+			break;
+		}
+		for( ssize_t i=0; i<amount; i++ )
+			if( data[i] == '\n' ){
+				cout << line << endl;
+				last = line;
+				line.clear();
+			}
+			else
+				line.push_back( data[i] );
+	}
+	close( fd );
+	
+	for( auto prefix : { "done ", "status: ", "stopping" } )
+		if( last.compare( 0, strlen( prefix ), prefix ) == 0 )
+			return 0;
+	return 1;
+}
@@ -0,0 +1,44 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAEMON_HPP
+#define DAEMON_HPP
+
+#include "Options.hpp"
+#include "VideoEncode.hpp"
+
+#include <QString>
+#include <QStringList>
+
+/* Long running mode for scripts calling vhsfix on many short clips, so the
+ * start up and the thread pool are paid once. Jobs are sent over a Unix
+ * socket and run on one shared Batch.
+ * A request is the working directory of the client followed by its
+ * arguments, each terminated by a NUL, and ends with an empty argument.
+ * The arguments are either "--status", "--stop" or the usual options
+ * followed by an input and optionally an output. The daemon replies with
+ * text lines and closes the connection once the job is done. */
+
+///Serves jobs on socket_path until stopped by a client, options and encode
+///are the defaults of every job. Returns the process exit code
+int runDaemon( QString socket_path, unsigned threads, const Options& options, const EncodeSettings& encode );
+
+///Sends args to the daemon at socket_path and prints the replies.
+///Returns 0 if the job succeeded
+int runClient( QString socket_path, const QStringList& args );
+
+#endif
@@ -0,0 +1,133 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DecodePool.hpp"
+
+#include <set>
+
+using namespace std;
+
+///Kernels may read a bit past the end of the last line
+const int buffer_padding = 64;
+
+namespace{
+	///Data of the buffers of every pool. They can outlive their pool, so
+	///this is shared by all of them
+	mutex allocated_lock;
+	set<const uint8_t*> allocated;
+}
+
+DecodePool::~DecodePool(){
+	//Buffers still in use stay valid, the pool is freed after the last one
+	for( auto& pool : pools )
+		av_buffer_pool_uninit( &pool );
+}
+
+void DecodePool::install( AVCodecContext* context ){
+	context->opaque = this;
+	context->get_buffer2 = getBuffer;
+	context->refcounted_frames = 1;
+}
+
+int DecodePool::getBuffer( AVCodecContext* context, AVFrame* frame, int flags ){
+	auto pool = static_cast<DecodePool*>( context->opaque );
+	if( !(context->codec->capabilities & CODEC_CAP_DR1) || !pool->allocate( context, frame ) )
+		return avcodec_default_get_buffer2( context, frame, flags );
+	return 0;
+}
+
+AVBufferRef* DecodePool::allocBuffer( void*, int size ){
+	auto data = static_cast<uint8_t*>( av_malloc( size ) );
+	if( !data )
+		return nullptr;
+	auto buffer = av_buffer_create( data, size, freeBuffer, nullptr, 0 );
+	if( !buffer ){
+		av_free( data );
+		return nullptr;
+	}
+	lock_guard<mutex> guard( allocated_lock );
+	allocated.insert( data );
+	return buffer;
+}
+
+void DecodePool::freeBuffer( void*, uint8_t* data ){
+	{	lock_guard<mutex> guard( allocated_lock );
+		allocated.erase( data );
+	}
+	av_free( data );
+}
+
+bool DecodePool::owns( const AVFrame* frame ){
+	lock_guard<mutex> guard( allocated_lock );
+	for( int i=0; i<AV_NUM_DATA_POINTERS && frame->data[i]; i++ )
+		if( !frame->buf[i] || frame->data[i] != frame->buf[i]->data || !allocated.count( frame->buf[i]->data ) )
+			return false;
+	return frame->data[0] != nullptr;
+}
+
+bool DecodePool::setup( AVCodecContext* context, AVFrame* frame ){
+	for( auto& pool : pools )
+		av_buffer_pool_uninit( &pool );
+	format = frame->format;
+	width = frame->width;
+	height = frame->height;
+	
+	auto pix_fmt = (AVPixelFormat)format;
+	auto desc = av_pix_fmt_desc_get( pix_fmt );
+	if( !desc || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL)) )
+		return false; //Palettes are left to the default allocator
+	
+	//Decoders write whole blocks, so past the visible size
+	int w = width, h = height;
+	int align[AV_NUM_DATA_POINTERS];
+	avcodec_align_dimensions2( context, &w, &h, align );
+	if( av_image_fill_linesizes( linesize, pix_fmt, w ) < 0 )
+		return false;
+	
+	int planes = av_pix_fmt_count_planes( pix_fmt );
+	for( int i=0; i<planes; i++ ){
+		//As the decoder asks, but at least what the kernels rely on
+		linesize[i] = FFALIGN( linesize[i], FFMAX( 32, align[i] ) );
+		int lines = ( i == 1 || i == 2 ) ? -((-h) >> desc->log2_chroma_h) : h;
+		pools[i] = av_buffer_pool_init2( linesize[i] * lines + buffer_padding, this, allocBuffer, nullptr );
+		if( !pools[i] )
+			return false;
+	}
+	return true;
+}
+
+bool DecodePool::allocate( AVCodecContext* context, AVFrame* frame ){
+	lock_guard<mutex> guard( lock );
+	if( frame->format != format || frame->width != width || frame->height != height )
+		if( !setup( context, frame ) ){
+			format = -1; //Try again on the next frame
+			return false;
+		}
+	
+	for( int i=0; i<4 && pools[i]; i++ ){
+		frame->buf[i] = av_buffer_pool_get( pools[i] );
+		if( !frame->buf[i] ){
+			for( int j=0; j<i; j++ )
+				av_buffer_unref( &frame->buf[j] );
+			return false;
+		}
+		frame->data[i] = frame->buf[i]->data;
+		frame->linesize[i] = linesize[i];
+	}
+	frame->extended_data = frame->data;
+	return true;
+}
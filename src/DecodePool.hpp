@@ -0,0 +1,57 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DECODE_POOL_HPP
+#define DECODE_POOL_HPP
+
+#include "ffmpeg.hpp"
+
+#include <mutex>
+
+/* Reusable buffers the decoder renders into, installed as its get_buffer2.
+ * Planes get the 32 byte aligned rows of ffmpeg::Frame and padding after
+ * them, so a decoded frame in the working format can be handed over to a
+ * VideoFrame instead of copied. The buffers return to the pool once the
+ * last frame referring to them is done. */
+class DecodePool{
+	private:
+		std::mutex lock;
+		AVBufferPool* pools[4]{ nullptr, nullptr, nullptr, nullptr };
+		int format{ -1 };
+		int width{ 0 }, height{ 0 };
+		int linesize[4]{ 0, 0, 0, 0 };
+		
+		bool setup( AVCodecContext* context, AVFrame* frame );
+		bool allocate( AVCodecContext* context, AVFrame* frame );
+		static int getBuffer( AVCodecContext* context, AVFrame* frame, int flags );
+		static AVBufferRef* allocBuffer( void* opaque, int size );
+		static void freeBuffer( void* opaque, uint8_t* data );
+		
+	public:
+		DecodePool() { }
+		DecodePool( const DecodePool& ) = delete;
+		~DecodePool();
+		
+		///Must be done before the decoder is opened. The decoded frames are
+		///reference counted afterwards and must be unreferenced before reuse
+		void install( AVCodecContext* context );
+		
+		///True if every plane of frame is in a buffer of a DecodePool
+		static bool owns( const AVFrame* frame );
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Deinterlace.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+namespace{
+	///Rows of one field of a plane
+	template<typename Sample>
+	struct FieldView{
+		Sample* data;
+		size_t stride; ///In samples, skipping the other field
+		
+		FieldView( uint8_t* plane, size_t linesize, unsigned parity )
+			:	data( reinterpret_cast<Sample*>( plane + parity * linesize ) )
+			,	stride( 2 * linesize / sizeof(Sample) ) { }
+		
+		Sample* operator[]( unsigned y ) const{ return data + y * stride; }
+	};
+	
+	//The loops are branch free and the rows never overlap, so with the
+	//vectorizer flags in vhsfix.pro they are vectorized without alias checks
+	
+	///Weight 0 to 256 of the interpolated pixels, from the change since the
+	///last frame in this line and the lines around it of the other field
+	template<typename Sample>
+	void motionMask( const Sample* __restrict cur, const Sample* __restrict prev
+		,	const Sample* __restrict above, const Sample* __restrict prev_above
+		,	const Sample* __restrict below, const Sample* __restrict prev_below
+		,	uint16_t* __restrict mask, unsigned width, int threshold ){
+		//Full weight at twice the threshold
+		int scale = (256 << 8) / threshold;
+		for( unsigned ix=0; ix<width; ix++ ){
+			int same_field = abs( cur[ix] - prev[ix] );
+			int other_field = ( abs( above[ix] - prev_above[ix] ) + abs( below[ix] - prev_below[ix] ) + 1 ) >> 1;
+			int motion = max( same_field, other_field ) - threshold;
+			mask[ix] = min( ( max( motion, 0 ) * scale ) >> 8, 256 );
+		}
+	}
+	
+	///Widens the mask by a pixel, as the edges of moving objects comb first
+	void dilateMask( const uint16_t* __restrict mask, uint16_t* __restrict out, unsigned width ){
+		out[0] = max( mask[0], mask[1] );
+		for( unsigned ix=1; ix<width-1; ix++ ){
+			//Values, as max() on references keeps the loop from vectorizing
+			uint16_t left = mask[ix-1], middle = mask[ix], right = mask[ix+1];
+			uint16_t wider = left > middle ? left : middle;
+			out[ix] = wider > right ? wider : right;
+		}
+		out[width-1] = max( mask[width-2], mask[width-1] );
+	}
+	
+	template<typename Sample>
+	void blendRow( Sample* __restrict cur, const Sample* __restrict above, const Sample* __restrict below
+		,	const uint16_t* __restrict mask, unsigned width ){
+		for( unsigned ix=0; ix<width; ix++ ){
+			int interpolated = ( above[ix] + below[ix] + 1 ) >> 1;
+			cur[ix] = cur[ix] + ( ( (interpolated - cur[ix]) * mask[ix] + 128 ) >> 8 );
+		}
+	}
+}
+
+Deinterlace::Deinterlace( int threshold )
+	:	max_threshold( max( 1, threshold ) ), threshold( max_threshold ) { }
+
+void Deinterlace::reset( unsigned width, unsigned height, unsigned depth ){
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	threshold = max_threshold << (depth - 8);
+	
+	unsigned bytes = depth > 8 ? 2 : 1;
+	primed = false;
+	previous.assign( size_t(width) * height * bytes, 0 );
+	current.assign( previous.size(), 0 );
+	mask.assign( 2 * width, 0 );
+}
+
+template<typename Sample>
+void Deinterlace::deinterlace( ffmpeg::Frame& frame ){
+	auto av_frame = frame.getFrame();
+	FieldView<Sample> top( av_frame->data[0], av_frame->linesize[0], 0 );
+	FieldView<Sample> bottom( av_frame->data[0], av_frame->linesize[0], 1 );
+	FieldView<Sample> prev_top( previous.data(), width * sizeof(Sample), 0 );
+	FieldView<Sample> prev_bottom( previous.data(), width * sizeof(Sample), 1 );
+	FieldView<Sample> keep_top( current.data(), width * sizeof(Sample), 0 );
+	FieldView<Sample> keep_bottom( current.data(), width * sizeof(Sample), 1 );
+	
+	unsigned lines = height / 2;
+	uint16_t* raw = mask.data();
+	uint16_t* wide = mask.data() + width;
+	//Without a previous frame motion can't be told apart from detail, so
+	//all of the first one is interpolated
+	if( !primed )
+		fill( wide, wide + width, 256 );
+	for( unsigned iy=0; iy<lines; iy++ ){
+		//The input is needed as the previous frame next time
+		memcpy( keep_top[iy], top[iy], width * sizeof(Sample) );
+		memcpy( keep_bottom[iy], bottom[iy], width * sizeof(Sample) );
+		
+		//Bottom line iy sits between top lines iy and iy+1
+		unsigned next = min( iy+1, lines-1 );
+		if( primed ){
+			motionMask( bottom[iy], prev_bottom[iy], top[iy], prev_top[iy], top[next], prev_top[next]
+				,	raw, width, threshold );
+			dilateMask( raw, wide, width );
+		}
+		blendRow( bottom[iy], top[iy], top[next], wide, width );
+	}
+	
+	previous.swap( current );
+	primed = true;
+}
+
+void Deinterlace::process( ffmpeg::Frame& frame ){
+	if( frame.width() != width || frame.height() != height || frame.depth() != depth )
+		reset( frame.width(), frame.height(), frame.depth() );
+	
+	if( depth > 8 )
+		deinterlace<uint16_t>( frame );
+	else
+		deinterlace<uint8_t>( frame );
+}
@@ -0,0 +1,57 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEINTERLACE_HPP
+#define DEINTERLACE_HPP
+
+#include "ffmpeg.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+/* Motion adaptive deinterlacing of the luma plane. The top field is kept,
+ * and each pixel of the bottom field is compared with the same place in the
+ * previous frame, in both fields. Where nothing moved the fields are woven
+ * together at full resolution, where it did the bottom field is replaced by
+ * interpolating the top field, with a soft transition in between. The
+ * first frame has nothing to compare with and is interpolated everywhere.
+ * Chroma is already merged from both fields when the frame is read. */
+class Deinterlace{
+	private:
+		int max_threshold;
+		int threshold;        ///Scaled to the depth
+		
+		unsigned width{ 0 };
+		unsigned height{ 0 };
+		unsigned depth{ 0 };
+		bool primed{ false };  ///previous holds a frame
+		std::vector<uint8_t> previous; ///Luma of the last frame, before deinterlacing
+		std::vector<uint8_t> current;  ///Becomes previous after this frame
+		std::vector<uint16_t> mask;    ///Blend weight of one line, 0 to 256
+		
+		void reset( unsigned width, unsigned height, unsigned depth );
+		template<typename Sample>
+		void deinterlace( ffmpeg::Frame& frame );
+		
+	public:
+		///Field differences above threshold are motion, in 8 bit units
+		Deinterlace( int threshold );
+		
+		void process( ffmpeg::Frame& frame );
+};
+
+#endif
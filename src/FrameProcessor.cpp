@@ -0,0 +1,171 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FrameProcessor.hpp"
+#include "VideoFrame.hpp"
+#include "Instrument.hpp"
+
+#include <cstdlib>
+
+using namespace std;
+
+namespace{
+	const unsigned block_size = 16;
+	///Largest change of a block mean in a repeated frame, 1/16 of 8 bit levels.
+	///Averaging over a block brings tape noise well below this
+	const int repeat_threshold = 2 * 16;
+}
+
+///Mean luma of each block, from every other line. Reads any format
+///VideoFrame::canConvert() accepts, so both decoded and converted frames
+template<typename Sample>
+static void blockMeans( ffmpeg::Frame& frame, vector<int>& means ){
+	auto& luma = av_pix_fmt_desc_get( frame.format() )->comp[0];
+	auto av_frame = frame.getFrame();
+	unsigned stride = (luma.step_minus1 + 1) / sizeof(Sample);
+	unsigned blocks_x = frame.width() / block_size, blocks_y = frame.height() / block_size;
+	means.assign( blocks_x * blocks_y, 0 );
+	
+	for( unsigned iy=0; iy<blocks_y*block_size; iy+=2 ){
+		auto row = reinterpret_cast<const Sample*>( av_frame->data[luma.plane] + iy * av_frame->linesize[luma.plane] + luma.offset_plus1 - 1 );
+		auto out = means.begin() + iy / block_size * blocks_x;
+		for( unsigned bx=0; bx<blocks_x; bx++ ){
+			int sum = 0;
+			for( unsigned ix=bx*block_size; ix<(bx+1)*block_size; ix++ )
+				sum += row[ix*stride] >> luma.shift;
+			out[bx] += sum;
+		}
+	}
+	
+	//Scaled to 1/16 of 8 bit levels, 128 samples of each block were summed
+	int scale = luma.depth_minus1 + 1 - 8 + 3;
+	for( auto& mean : means )
+		mean >>= scale;
+}
+
+static void blockMeans( ffmpeg::Frame& frame, vector<int>& means ){
+	if( av_pix_fmt_desc_get( frame.format() )->comp[0].depth_minus1 >= 8 )
+		blockMeans<uint16_t>( frame, means );
+	else
+		blockMeans<uint8_t>( frame, means );
+}
+
+FrameProcessor::FrameProcessor( const Options& options ) : options(options) {
+	if( options.denoise > 1 )
+		denoise.reset( new ChromaDenoise( options.denoise, options.denoise_threshold ) );
+	if( options.stabilise > 0 )
+		stabilise.reset( new Stabilise( options.stabilise ) );
+	if( options.deinterlace > 0 )
+		deinterlace.reset( new Deinterlace( options.deinterlace ) );
+	if( options.grading() ){
+		colour.reset( new ColourLut() );
+		if( options.lut.isEmpty() )
+			colour->generate( options.lift, options.gamma, options.gain );
+		else if( !colour->loadCube( options.lut ) )
+			colour.reset();
+	}
+}
+
+bool FrameProcessor::isRepeat( ffmpeg::Frame& frame ){
+	//Noise makes repeated frames differ a little everywhere, while any motion
+	//changes some blocks by more
+	blockMeans( frame, current_blocks );
+	bool repeat = current_blocks.size() == last_blocks.size();
+	for( unsigned i=0; repeat && i<current_blocks.size(); i++ )
+		repeat = abs( current_blocks[i] - last_blocks[i] ) <= repeat_threshold;
+	
+	//Compared with the last processed frame, so slow changes still add up
+	if( !repeat )
+		last_blocks.swap( current_blocks );
+	return repeat;
+}
+
+bool FrameProcessor::prepare( VideoFrame& frame ){
+	//Only touches chroma, so it is independent of the duplicate detection
+	if( denoise ){
+		INSTRUMENT_SCOPE( DENOISE );
+		denoise->process( frame );
+	}
+	
+	if( isRepeat( frame ) ){
+		INSTRUMENT_COUNT( DUPLICATES, 1 );
+		duplicates++;
+		return false;
+	}
+	return true;
+}
+
+void FrameProcessor::finish( VideoFrame& frame, bool processed, const FrameCorrection& correction ){
+	//Repeats are corrected like the frame they repeat, without searching again
+	if( processed )
+		last_correction = correction;
+	else
+		frame.apply( last_correction );
+	
+	postProcess( frame );
+}
+
+void FrameProcessor::postProcess( VideoFrame& frame ){
+	//Runs on every frame, as the motion of duplicates is part of the trajectory
+	if( stabilise ){
+		INSTRUMENT_SCOPE( STABILISE );
+		stabilise->process( frame );
+	}
+	
+	//After stabilising, so less of the picture is seen as moving
+	if( deinterlace ){
+		INSTRUMENT_SCOPE( DEINTERLACE );
+		deinterlace->process( frame );
+	}
+	
+	if( colour ){
+		INSTRUMENT_SCOPE( COLOUR );
+		colour->process( frame );
+	}
+}
+
+void FrameProcessor::process( VideoFrame& frame ){
+	FrameCorrection correction;
+	bool processed = prepare( frame );
+	if( processed ){
+		frame.analyse( correction );
+		frame.apply( correction );
+	}
+	finish( frame, processed, correction );
+}
+
+void FrameProcessor::process( VideoFrame& frame, ffmpeg::Frame& source ){
+	//Found on the decoded luma, so the search can be skipped while converting
+	if( isRepeat( source ) ){
+		INSTRUMENT_COUNT( DUPLICATES, 1 );
+		duplicates++;
+		{	INSTRUMENT_SCOPE( INIT );
+			frame.initFrame( source );
+		}
+		frame.apply( last_correction );
+	}
+	else
+		frame.processBands( source, nullptr, &last_correction );
+	av_frame_unref( source.getFrame() );
+	
+	//Only touches chroma, so the order relative to the luma stages is free
+	if( denoise ){
+		INSTRUMENT_SCOPE( DENOISE );
+		denoise->process( frame );
+	}
+	postProcess( frame );
+}
@@ -0,0 +1,70 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAME_PROCESSOR_HPP
+#define FRAME_PROCESSOR_HPP
+
+#include "Options.hpp"
+#include "ChromaDenoise.hpp"
+#include "Stabilise.hpp"
+#include "Deinterlace.hpp"
+#include "ColourLut.hpp"
+#include "VideoFrame.hpp"
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+///Processes the frames of one stream in order, keeping state between frames
+class FrameProcessor{
+	private:
+		const Options& options;
+		std::unique_ptr<ChromaDenoise> denoise;
+		std::unique_ptr<Stabilise> stabilise;
+		std::unique_ptr<Deinterlace> deinterlace;
+		std::unique_ptr<ColourLut> colour;
+		
+		//Repeated frames, which get the corrections of the last processed one
+		std::vector<int> last_blocks, current_blocks;
+		FrameCorrection last_correction;
+		unsigned duplicates{ 0 };
+		
+		///If frame is the last processed one again, apart from noise
+		bool isRepeat( ffmpeg::Frame& frame );
+		///The stages working on the finished frames
+		void postProcess( VideoFrame& frame );
+		
+	public:
+		FrameProcessor( const Options& options );
+		
+		void process( VideoFrame& frame );
+		///process() with initFrame() fused in, using VideoFrame::processBands().
+		///Duplicates are found on the decoded frame and skip the search
+		void process( VideoFrame& frame, ffmpeg::Frame& source );
+		
+		///process() split up, so the corrections can be found in parallel.
+		///prepare() and finish() must each be called in frame order, but
+		///prepare() may run ahead of finish() on another thread.
+		///prepare() returns false for duplicates, which need no analysing.
+		///Processed frames are given to finish() with the correction applied
+		bool prepare( VideoFrame& frame );
+		void finish( VideoFrame& frame, bool processed, const FrameCorrection& correction );
+		
+		unsigned duplicateCount() const{ return duplicates; }
+};
+
+#endif
@@ -0,0 +1,215 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Instrument.hpp"
+
+#if defined(VHSFIX_INSTRUMENT) && defined(__linux__)
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#define VHSFIX_PERF
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+using namespace instrument;
+
+namespace{
+	const char* stage_names[STAGE_COUNT] = { "decode", "init", "denoise", "stabilise", "deinterlace", "colour", "alignment", "bottom", "encode" };
+	const char* counter_names[COUNTER_COUNT] = { "frames", "lines", "sad_evals", "duplicates" };
+	
+	mutex registry_lock;
+	vector<unique_ptr<ThreadStats>> registry;
+	
+	//Reference points for converting ticks to seconds
+	const uint64_t start_ticks = ticks();
+	const auto start_time = chrono::steady_clock::now();
+	
+	double ticksPerSecond(){
+		double seconds = chrono::duration<double>( chrono::steady_clock::now() - start_time ).count();
+		uint64_t elapsed = ticks() - start_ticks;
+		return ( seconds > 0 && elapsed > 0 ) ? elapsed / seconds : 1e9;
+	}
+	
+	void writeHistogram( FILE* f, const char* name, const uint64_t* values, int count, int offset, double step ){
+		fprintf( f, "\t\"%s\": {", name );
+		bool first = true;
+		for( int i=0; i<count; i++ )
+			if( values[i] ){
+				fprintf( f, "%s \"%g\": %llu", first ? "" : ",", (i - offset) * step, (unsigned long long)values[i] );
+				first = false;
+			}
+		fprintf( f, " }" );
+	}
+}
+
+ThreadStats& instrument::local(){
+	thread_local ThreadStats* stats = nullptr;
+	if( !stats ){
+		lock_guard<mutex> guard( registry_lock );
+		registry.emplace_back( new ThreadStats() );
+		stats = registry.back().get();
+	}
+	return *stats;
+}
+
+bool instrument::writeSummary( const char* path ){
+	//Sum up all threads. Other threads should have finished by now
+	ThreadStats total;
+	unsigned threads;
+	{
+		lock_guard<mutex> guard( registry_lock );
+		threads = registry.size();
+		for( auto& stats : registry ){
+			for( int i=0; i<STAGE_COUNT; i++ ){
+				total.ticks[i] += stats->ticks[i];
+				total.calls[i] += stats->calls[i];
+			}
+			for( int i=0; i<COUNTER_COUNT; i++ )
+				total.counters[i] += stats->counters[i];
+			for( int i=0; i<SHIFT_RANGE*2+1; i++ ){
+				total.shifts[i] += stats->shifts[i];
+				total.bottom_shifts[i] += stats->bottom_shifts[i];
+			}
+			for( int i=0; i<SCALE_BUCKETS; i++ )
+				total.scales[i] += stats->scales[i];
+		}
+	}
+	
+	FILE* f = fopen( path, "w" );
+	if( !f )
+		return false;
+	
+	double tps = ticksPerSecond();
+	double elapsed = chrono::duration<double>( chrono::steady_clock::now() - start_time ).count();
+	auto frames = total.counters[FRAMES];
+	
+	fprintf( f, "{\n\t\"threads\": %u,\n", threads );
+	fprintf( f, "\t\"elapsed_s\": %.3f,\n", elapsed );
+	fprintf( f, "\t\"fps\": %.3f,\n", elapsed > 0 ? frames / elapsed : 0.0 );
+	
+	fprintf( f, "\t\"stages\": {\n" );
+	for( int i=0; i<STAGE_COUNT; i++ ){
+		double seconds = total.ticks[i] / tps;
+		fprintf( f, "\t\t\"%s\": { \"calls\": %llu, \"total_ms\": %.3f, \"mean_us\": %.3f }%s\n"
+			,	stage_names[i], (unsigned long long)total.calls[i], seconds * 1000
+			,	total.calls[i] ? seconds * 1e6 / total.calls[i] : 0.0
+			,	i+1 < STAGE_COUNT ? "," : ""
+			);
+	}
+	fprintf( f, "\t},\n" );
+	
+	fprintf( f, "\t\"counters\": {" );
+	for( int i=0; i<COUNTER_COUNT; i++ )
+		fprintf( f, "%s \"%s\": %llu", i ? "," : "", counter_names[i], (unsigned long long)total.counters[i] );
+	fprintf( f, " },\n" );
+	
+	auto lines = total.counters[LINES];
+	fprintf( f, "\t\"sad_evals_per_line\": %.3f,\n", lines ? total.counters[SAD_EVALS] / double(lines) : 0.0 );
+	
+	writeHistogram( f, "shifts", total.shifts, SHIFT_RANGE*2+1, SHIFT_RANGE, 1 );
+	fprintf( f, ",\n" );
+	writeHistogram( f, "bottom_shifts", total.bottom_shifts, SHIFT_RANGE*2+1, SHIFT_RANGE, 1 );
+	fprintf( f, ",\n" );
+	writeHistogram( f, "bottom_scales", total.scales, SCALE_BUCKETS, -1000, 0.001 );
+	fprintf( f, "\n}\n" );
+	
+	return fclose( f ) == 0;
+}
+
+#ifdef VHSFIX_PERF
+namespace{
+	const double line_bytes = 64;
+	
+	int openCounter( uint64_t config ){
+		perf_event_attr attr;
+		memset( &attr, 0, sizeof(attr) );
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+	}
+	
+	uint64_t readCounter( int fd ){
+		uint64_t value = 0;
+		return read( fd, &value, sizeof(value) ) == sizeof(value) ? value : 0;
+	}
+}
+
+CacheTraffic::CacheTraffic()
+	:	references( openCounter( PERF_COUNT_HW_CACHE_REFERENCES ) )
+	,	misses( openCounter( PERF_COUNT_HW_CACHE_MISSES ) ) { }
+
+CacheTraffic::~CacheTraffic(){
+	if( references >= 0 )
+		close( references );
+	if( misses >= 0 )
+		close( misses );
+}
+
+void CacheTraffic::start(){
+	for( int fd : { references, misses } ){
+		ioctl( fd, PERF_EVENT_IOC_RESET, 0 );
+		ioctl( fd, PERF_EVENT_IOC_ENABLE, 0 );
+	}
+}
+
+void CacheTraffic::stop( double& cache_bytes, double& memory_bytes ){
+	for( int fd : { references, misses } )
+		ioctl( fd, PERF_EVENT_IOC_DISABLE, 0 );
+	cache_bytes = readCounter( references ) * line_bytes;
+	memory_bytes = readCounter( misses ) * line_bytes;
+}
+#else
+CacheTraffic::CacheTraffic() { }
+CacheTraffic::~CacheTraffic() { }
+void CacheTraffic::start() { }
+void CacheTraffic::stop( double& cache_bytes, double& memory_bytes ){
+	cache_bytes = memory_bytes = 0;
+}
+#endif
+
+void Progress::report( unsigned frame ){
+	auto now = chrono::steady_clock::now();
+	double window = chrono::duration<double>( now - last ).count();
+	double current_fps = window > 0 ? (frame - last_frame) / window : 0.0;
+	last = now;
+	last_frame = frame;
+	
+	cout << "Time: " << unsigned(frame / frame_rate) << "s";
+	cout << " (" << current_fps << " fps";
+	if( total > frame && current_fps > 0 ){
+		unsigned eta = unsigned( (total - frame) / averageFps() );
+		cout << ", ETA " << eta / 60 << "m" << eta % 60 << "s";
+	}
+	cout << ")\n";
+}
+
+double Progress::averageFps() const{
+	double elapsed = chrono::duration<double>( last - start ).count();
+	return elapsed > 0 ? last_frame / elapsed : 0.0;
+}
@@ -0,0 +1,159 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INSTRUMENT_HPP
+#define INSTRUMENT_HPP
+
+#include <chrono>
+#include <stdint.h>
+
+#if defined(VHSFIX_INSTRUMENT) && (defined(__x86_64__) || defined(__i386__))
+	#include <x86intrin.h>
+#endif
+
+/* Build with "CONFIG += instrument" to enable the counters and timers.
+ * Without it, every INSTRUMENT_* macro expands to nothing. */
+
+namespace instrument{
+	
+	enum Stage{
+			DECODE
+		,	INIT
+		,	DENOISE
+		,	STABILISE
+		,	DEINTERLACE
+		,	COLOUR
+		,	ALIGNMENT
+		,	BOTTOM
+		,	ENCODE
+		,	STAGE_COUNT
+	};
+	
+	enum Counter{
+			FRAMES
+		,	LINES
+		,	SAD_EVALS
+		,	DUPLICATES
+		,	COUNTER_COUNT
+	};
+	
+	const int SHIFT_RANGE  = 256; ///Histogram covers [-SHIFT_RANGE, SHIFT_RANGE]
+	const int SCALE_BUCKETS = 64; ///Scale histogram in steps of 0.001 from 1.0
+	
+	///Counters for one thread, only ever written by that thread
+	struct ThreadStats{
+		uint64_t ticks[STAGE_COUNT]{};
+		uint64_t calls[STAGE_COUNT]{};
+		uint64_t counters[COUNTER_COUNT]{};
+		uint64_t shifts[SHIFT_RANGE*2+1]{};
+		uint64_t bottom_shifts[SHIFT_RANGE*2+1]{};
+		uint64_t scales[SCALE_BUCKETS]{};
+	};
+	
+	///Stats for the calling thread, registered on first use
+	ThreadStats& local();
+	
+	///Writes a summary of all threads as JSON, returns false on failure
+	bool writeSummary( const char* path );
+	
+	inline uint64_t ticks(){
+	#if defined(VHSFIX_INSTRUMENT) && (defined(__x86_64__) || defined(__i386__))
+		return __rdtsc();
+	#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()
+			).count();
+	#endif
+	}
+	
+	class ScopedTimer{
+		private:
+			Stage stage;
+			uint64_t start;
+			
+		public:
+			ScopedTimer( Stage stage ) : stage(stage), start( ticks() ) { }
+			~ScopedTimer(){
+				auto& stats = local();
+				stats.ticks[stage] += ticks() - start;
+				stats.calls[stage]++;
+			}
+	};
+	
+	inline int clampShift( int dx ){
+		return (dx < -SHIFT_RANGE ? -SHIFT_RANGE : (dx > SHIFT_RANGE ? SHIFT_RANGE : dx)) + SHIFT_RANGE;
+	}
+	
+	inline int scaleBucket( double scale ){
+		int bucket = int( (scale - 1.0) * 1000 + 0.5 );
+		return bucket < 0 ? 0 : (bucket >= SCALE_BUCKETS ? SCALE_BUCKETS-1 : bucket);
+	}
+	
+	///Cache lines moved while measuring, from the hardware counters of the
+	///calling thread. Only in instrumented builds on Linux, and the kernel
+	///may still refuse access (perf_event_paranoid)
+	class CacheTraffic{
+		private:
+			int references{ -1 }; ///Requests missing the core's own caches
+			int misses{ -1 };     ///Of those, the ones read from memory
+			
+		public:
+			CacheTraffic();
+			CacheTraffic( const CacheTraffic& ) = delete;
+			~CacheTraffic();
+			
+			bool available() const{ return references >= 0 && misses >= 0; }
+			void start();
+			///Bytes since start(), into the last level cache and from memory
+			void stop( double& cache_bytes, double& memory_bytes );
+	};
+	
+	///Realtime fps and ETA, always available as it only runs once per report
+	class Progress{
+		private:
+			std::chrono::steady_clock::time_point start;
+			std::chrono::steady_clock::time_point last;
+			unsigned last_frame{ 0 };
+			unsigned total;
+			double frame_rate;
+			
+		public:
+			///total_frames may be 0 if unknown, which disables the ETA
+			Progress( unsigned total_frames, double frame_rate )
+				:	start( std::chrono::steady_clock::now() ), last( start )
+				,	total( total_frames ), frame_rate( frame_rate ) { }
+			
+			void report( unsigned frame );
+			double averageFps() const;
+	};
+}
+
+#ifdef VHSFIX_INSTRUMENT
+	#define INSTRUMENT_SCOPE( stage ) instrument::ScopedTimer instrument_scope_timer( instrument::stage )
+	#define INSTRUMENT_COUNT( counter, amount ) (instrument::local().counters[instrument::counter] += (amount))
+	#define INSTRUMENT_SHIFT( dx ) (instrument::local().shifts[instrument::clampShift( dx )]++)
+	#define INSTRUMENT_BOTTOM( dx, scale ) \
+		(instrument::local().bottom_shifts[instrument::clampShift( dx )]++, \
+		 instrument::local().scales[instrument::scaleBucket( scale )]++)
+#else
+	#define INSTRUMENT_SCOPE( stage )
+	#define INSTRUMENT_COUNT( counter, amount ) ((void)0)
+	#define INSTRUMENT_SHIFT( dx ) ((void)0)
+	#define INSTRUMENT_BOTTOM( dx, scale ) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <QString>
+
+#include <cstddef>
+#include <stdint.h>
+
+///File access of the input and outputs, see AsyncIO.hpp
+struct IoSettings{
+	bool async{ true };                   ///Read ahead and write behind in the background
+	unsigned latency{ 0 };                ///Milliseconds added to every block, to test slow storage
+	size_t block_size{ 2 * 1024 * 1024 }; ///Bytes read or written at once
+	unsigned blocks{ 4 };                 ///Blocks buffered for each file
+};
+
+///Settings for a processing run, filled from the command line
+struct Options{
+	size_t max_memory{ 64 * 1024 * 1024 }; ///Budget for frames in flight, in bytes
+	
+	double start{ 0.0 };     ///Seconds into the input to start at
+	double duration{ -1.0 }; ///Seconds to process, negative for the rest of the input
+	int64_t frames{ -1 };    ///Frames to process, overrides duration when set
+	
+	unsigned head_switch{ 0 }; ///Lines in the head switching band, 0 to estimate from the height
+	
+	unsigned denoise{ 0 };        ///Frames averaged for chroma noise reduction, 0 to disable
+	int denoise_threshold{ 6 };   ///Larger chroma differences are treated as motion
+	
+	double stabilise{ 0.0 }; ///Smoothing of the camera motion, 0 to disable
+	int deinterlace{ 0 };    ///Field difference treated as motion, 0 to keep the frames interlaced
+	
+	QString lut;                     ///3D LUT in .cube format graded with, empty for none
+	double lift[3]{ 0.0, 0.0, 0.0 }; ///Per RGB channel, graded with when there is no LUT
+	double gamma[3]{ 1.0, 1.0, 1.0 };
+	double gain[3]{ 1.0, 1.0, 1.0 };
+	
+	unsigned preview{ 0 };    ///Search corrections every this many frames at half resolution, 0 for full quality
+	
+	double checkpoint{ 0.0 }; ///Seconds between checkpoints, 0 to disable
+	bool resume{ false };     ///Continue from the last checkpoint
+	
+	IoSettings io;
+	
+	bool grading() const{
+		for( int c=0; c<3; c++ )
+			if( lift[c] != 0.0 || gamma[c] != 1.0 || gain[c] != 1.0 )
+				return true;
+		return !lut.isEmpty();
+	}
+	
+	///Amount of frames to process, -1 if unlimited
+	int64_t frameLimit( double fps ) const{
+		if( frames >= 0 )
+			return frames;
+		return duration >= 0 ? int64_t( duration * fps + 0.5 ) : -1;
+	}
+};
+
+#endif
@@ -0,0 +1,125 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PacketIndex.hpp"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+
+#include <zlib.h>
+
+#include <algorithm>
+
+using namespace std;
+
+static const char index_magic[8] = { 'V', 'H', 'S', 'I', 'D', 'X', '0', '2' };
+static const int64_t head_bytes = 64 * 1024;
+
+bool PacketIndex::identify( QString input, Source& source ){
+	QFileInfo info( input );
+	QFile f( input );
+	if( !info.isFile() || !f.open( QIODevice::ReadOnly ) )
+		return false;
+	
+	source.size = info.size();
+	source.modified = info.lastModified().toMSecsSinceEpoch();
+	auto head = f.read( head_bytes );
+	source.head_crc = crc32( crc32( 0, nullptr, 0 ), (const Bytef*)head.constData(), head.size() );
+	return true;
+}
+
+bool PacketIndex::load( QString path, const Source& source ){
+	QFile f( path );
+	if( !f.open( QIODevice::ReadOnly ) )
+		return false;
+	
+	char magic[8];
+	Source stored;
+	int64_t count;
+	if( f.read( magic, sizeof(magic) ) != sizeof(magic) || !equal( magic, magic+8, index_magic ) )
+		return false;
+	if( f.read( (char*)&stored.size, sizeof(stored.size) ) != sizeof(stored.size)
+		|| f.read( (char*)&stored.modified, sizeof(stored.modified) ) != sizeof(stored.modified)
+		|| f.read( (char*)&stored.head_crc, sizeof(stored.head_crc) ) != sizeof(stored.head_crc)
+		|| !(stored == source) )
+		return false; //Input has changed since the index was made
+	if( f.read( (char*)&count, sizeof(count) ) != sizeof(count) || count < 0 )
+		return false;
+	
+	entries.resize( count );
+	int64_t bytes = count * sizeof(Entry);
+	if( f.read( (char*)entries.data(), bytes ) != bytes ){
+		entries.clear();
+		return false;
+	}
+	findKeyframes();
+	return true;
+}
+
+bool PacketIndex::save( QString path, const Source& source ) const{
+	QFile f( path );
+	if( !f.open( QIODevice::WriteOnly ) )
+		return false;
+	
+	int64_t count = entries.size();
+	f.write( index_magic, sizeof(index_magic) );
+	f.write( (const char*)&source.size, sizeof(source.size) );
+	f.write( (const char*)&source.modified, sizeof(source.modified) );
+	f.write( (const char*)&source.head_crc, sizeof(source.head_crc) );
+	f.write( (const char*)&count, sizeof(count) );
+	int64_t bytes = count * sizeof(Entry);
+	return f.write( (const char*)entries.data(), bytes ) == bytes;
+}
+
+void PacketIndex::build( AVFormatContext* context, int stream_index ){
+	entries.clear();
+	
+	//Packets without any timestamp are placed after the one before them,
+	//as AV_NOPTS_VALUE would sort them first and shift every frame
+	AVPacket packet;
+	int64_t last_time = AV_NOPTS_VALUE;
+	while( av_read_frame( context, &packet ) >= 0 ){
+		if( packet.stream_index == stream_index ){
+			Entry entry;
+			entry.pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+			if( entry.pts == AV_NOPTS_VALUE )
+				entry.pts = last_time;
+			last_time = entry.pts;
+			entry.pos = packet.pos;
+			entry.key = ( packet.flags & AV_PKT_FLAG_KEY ) ? 1 : 0;
+			entries.push_back( entry );
+		}
+		av_free_packet( &packet );
+	}
+	
+	stable_sort( entries.begin(), entries.end()
+		,	[]( const Entry& a, const Entry& b ){ return a.pts < b.pts; } );
+	findKeyframes();
+}
+
+void PacketIndex::findKeyframes(){
+	keyframes.clear();
+	for( int64_t i=0; i<size(); i++ )
+		if( entries[i].key )
+			keyframes.push_back( i );
+}
+
+int64_t PacketIndex::keyframeBefore( int64_t frame ) const{
+	auto after = upper_bound( keyframes.begin(), keyframes.end(), frame );
+	return after == keyframes.begin() ? -1 : *(after - 1);
+}
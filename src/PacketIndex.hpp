@@ -0,0 +1,74 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PACKET_INDEX_HPP
+#define PACKET_INDEX_HPP
+
+#include "ffmpeg.hpp"
+
+#include <QString>
+
+#include <stdint.h>
+#include <vector>
+
+/* Timestamp and position of every packet in the video stream, in
+ * presentation order, so frame N can be found without decoding anything
+ * before it. Built by reading all packets once, and cached next to the
+ * input as "<input>.vhsidx". */
+class PacketIndex{
+	public:
+		struct Entry{
+			int64_t pts;
+			int64_t pos;
+			int64_t key;
+		};
+		
+		///What the cache is checked against, the input could be replaced
+		///by another file of the same size
+		struct Source{
+			int64_t size{ -1 };
+			int64_t modified{ -1 }; ///Milliseconds since the epoch
+			int64_t head_crc{ 0 };  ///Of the first bytes, the header and first packets
+			
+			bool operator==( const Source& other ) const{
+				return size == other.size && modified == other.modified && head_crc == other.head_crc;
+			}
+		};
+		///false if input isn't a local file, which then can't be cached
+		static bool identify( QString input, Source& source );
+		
+	private:
+		std::vector<Entry> entries;
+		std::vector<int64_t> keyframes; ///Entries which are keyframes, ascending
+		
+		void findKeyframes();
+		
+	public:
+		bool load( QString path, const Source& source );
+		bool save( QString path, const Source& source ) const;
+		
+		///Reads every packet of the stream, leaves the demuxer at the end
+		void build( AVFormatContext* context, int stream_index );
+		
+		int64_t size() const{ return entries.size(); }
+		const Entry& operator[]( int64_t frame ) const{ return entries[frame]; }
+		
+		///The last keyframe at or before frame, -1 if there is none
+		int64_t keyframeBefore( int64_t frame ) const;
+};
+
+#endif
@@ -0,0 +1,56 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Preview.hpp"
+#include "FrameProcessor.hpp"
+
+using namespace std;
+
+const unsigned preview_decimate = 2;
+
+void Preview::complete( VideoFrame& frame, bool processed, const FrameCorrection& correction ){
+	if( processed )
+		frame.apply( correction );
+	processor.finish( frame, processed, correction );
+}
+
+bool Preview::add( VideoFrame& frame ){
+	bool processed = processor.prepare( frame );
+	if( count++ % interval != 0 ){
+		pending.emplace_back( &frame, processed );
+		return false;
+	}
+	
+	//Duplicates are analysed too, the input is the same as the last frame
+	FrameCorrection next;
+	frame.analyse( next, preview_decimate );
+	for( unsigned i=0; i<pending.size(); i++ ){
+		double t = (i + 1) / double( pending.size() + 1 );
+		complete( *pending[i].first, pending[i].second, FrameCorrection::interpolate( last, next, t ) );
+	}
+	pending.clear();
+	
+	complete( frame, processed, next );
+	last = next;
+	return true;
+}
+
+void Preview::flush(){
+	for( auto& frame : pending )
+		complete( *frame.first, frame.second, last );
+	pending.clear();
+}
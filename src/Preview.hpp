@@ -0,0 +1,52 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PREVIEW_HPP
+#define PREVIEW_HPP
+
+#include "VideoFrame.hpp"
+
+#include <utility>
+#include <vector>
+
+class FrameProcessor;
+
+/* Fast preview of the processing. The corrections are only searched for on
+ * every interval-th frame and at half the horizontal resolution, the frames
+ * in between get them linearly interpolated. Those are held back until the
+ * next analysed frame is known. */
+class Preview{
+	private:
+		FrameProcessor& processor;
+		unsigned interval;
+		unsigned count{ 0 };
+		std::vector<std::pair<VideoFrame*,bool>> pending; ///With whether it needs processing
+		FrameCorrection last;
+		
+		void complete( VideoFrame& frame, bool processed, const FrameCorrection& correction );
+		
+	public:
+		Preview( FrameProcessor& processor, unsigned interval )
+			:	processor(processor), interval(interval) { }
+		
+		///Returns true when frame and every frame added before it are done
+		bool add( VideoFrame& frame );
+		///Completes the held frames with the last corrections
+		void flush();
+};
+
+#endif
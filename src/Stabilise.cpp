@@ -0,0 +1,212 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Stabilise.hpp"
+#include "VideoLine.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace{
+	const unsigned block_size = 16;
+	const int coarse_range = 4; ///At quarter resolution, so 16 pixels in the frame
+	
+	unsigned blockSad( const vector<uint8_t>& a, const vector<uint8_t>& b, unsigned width
+		,	int x, int y, int dx, int dy ){
+		unsigned sum = 0;
+		for( unsigned iy=0; iy<block_size; iy++ )
+			sum += sadRow( a.data() + (y+iy)*width + x, b.data() + (y+iy+dy)*width + x+dx, block_size );
+		return sum;
+	}
+	
+	struct Vector{ int x, y; };
+	
+	///Best offset of every block within range around the guess
+	vector<Vector> matchBlocks( const vector<uint8_t>& cur, const vector<uint8_t>& prev, unsigned width, unsigned height
+		,	Vector guess, int range, int margin ){
+		vector<Vector> vectors;
+		for( unsigned y=margin; y+block_size+margin<=height; y+=block_size )
+			for( unsigned x=margin; x+block_size+margin<=width; x+=block_size ){
+				unsigned best = -1;
+				Vector best_v = guess;
+				for( int dy=guess.y-range; dy<=guess.y+range; dy++ )
+					for( int dx=guess.x-range; dx<=guess.x+range; dx++ ){
+						auto sad = blockSad( cur, prev, width, x, y, dx, dy );
+						if( sad < best ){
+							best = sad;
+							best_v = { dx, dy };
+						}
+					}
+				vectors.push_back( best_v );
+			}
+		return vectors;
+	}
+	
+	int median( vector<int> values ){
+		if( values.empty() )
+			return 0;
+		nth_element( values.begin(), values.begin() + values.size()/2, values.end() );
+		return values[ values.size()/2 ];
+	}
+	
+	///Vertex of the parabola through three costs, in [-0.5, 0.5]
+	double subPixel( double left, double center, double right ){
+		double denominator = left - 2*center + right;
+		if( denominator <= 0 )
+			return 0.0;
+		return max( -0.5, min( 0.5, 0.5 * (left - right) / denominator ) );
+	}
+	
+	///Bilinear horizontal and vertical shift of one plane. Interlaced frames
+	///are shifted per field, so the fields are never blended together
+	template<typename Sample>
+	void shiftPlane( Sample* data, unsigned stride, unsigned width, unsigned height
+		,	double dx, double dy, vector<Sample>& buffer ){
+		buffer.resize( stride * height );
+		copy( data, data + stride * height, buffer.begin() );
+		
+		double field_dy = dy / 2;
+		int ix0 = floor( -dx ), iy0 = floor( -field_dy );
+		unsigned wx = unsigned( (-dx - ix0) * 256 ), wy = unsigned( (-field_dy - iy0) * 256 );
+		unsigned field_height = height / 2;
+		
+		for( unsigned iy=0; iy<height; iy++ ){
+			unsigned field = iy % 2;
+			int fy = iy / 2 + iy0;
+			auto source = [&]( int y ){
+				y = max( 0, min( int(field_height)-1, y ) );
+				return buffer.data() + (y*2 + field) * stride;
+			};
+			auto top = source( fy ), bottom = source( fy+1 );
+			auto out = data + iy * stride;
+			
+			for( unsigned ix=0; ix<width; ix++ ){
+				int x0 = max( 0, min( int(width)-1, int(ix) + ix0 ) );
+				int x1 = max( 0, min( int(width)-1, int(ix) + ix0 + 1 ) );
+				unsigned upper = top[x0] * (256 - wx) + top[x1] * wx;
+				unsigned lower = bottom[x0] * (256 - wx) + bottom[x1] * wx;
+				out[ix] = ( upper * (256 - wy) + lower * wy + (1 << 15) ) >> 16;
+			}
+		}
+	}
+}
+
+template<typename Sample>
+void Stabilise::Level::downscale( const Sample* in, unsigned in_width, unsigned in_height, unsigned stride, unsigned shift ){
+	width = in_width / 2;
+	height = in_height / 2;
+	data.resize( width * height );
+	for( unsigned iy=0; iy<height; iy++ ){
+		auto row1 = in + iy*2 * stride, row2 = row1 + stride;
+		auto out = data.data() + iy * width;
+		for( unsigned ix=0; ix<width; ix++ )
+			out[ix] = ( row1[ix*2] + row1[ix*2+1] + row2[ix*2] + row2[ix*2+1] + (2 << shift) ) >> (2 + shift);
+	}
+}
+
+bool Stabilise::estimate( double& dx, double& dy ) const{
+	//Coarse search at quarter resolution, refined at half
+	auto vectors = matchBlocks( current[1].data, previous[1].data, current[1].width, current[1].height
+		,	{ 0, 0 }, coarse_range, coarse_range );
+	
+	//Blocks not agreeing with the global motion (moving objects) are outliers
+	vector<int> xs, ys;
+	for( auto v : vectors ){
+		xs.push_back( v.x );
+		ys.push_back( v.y );
+	}
+	int coarse_x = median( xs ), coarse_y = median( ys );
+	unsigned inliers = count_if( vectors.begin(), vectors.end(), [&]( Vector v ){
+			return abs( v.x - coarse_x ) <= 1 && abs( v.y - coarse_y ) <= 1;
+		} );
+	if( vectors.empty() || inliers * 2 < vectors.size() )
+		return false; //Probably a scene change
+	
+	//Refine all blocks from the global estimate
+	auto& cur = current[0];
+	auto& prev = previous[0];
+	int margin = 2 * coarse_range + 2;
+	vectors = matchBlocks( cur.data, prev.data, cur.width, cur.height, { coarse_x*2, coarse_y*2 }, 1, margin );
+	xs.clear();
+	ys.clear();
+	for( auto v : vectors ){
+		xs.push_back( v.x );
+		ys.push_back( v.y );
+	}
+	int fine_x = median( xs ), fine_y = median( ys );
+	
+	//Sub-pixel from the total cost around the global offset
+	auto cost = [&]( int ox, int oy ){
+		double sum = 0;
+		for( unsigned y=margin; y+block_size+margin<=cur.height; y+=block_size )
+			for( unsigned x=margin; x+block_size+margin<=cur.width; x+=block_size )
+				sum += blockSad( cur.data, prev.data, cur.width, x, y, ox, oy );
+		return sum;
+	};
+	double center = cost( fine_x, fine_y );
+	double sub_x = subPixel( cost( fine_x-1, fine_y ), center, cost( fine_x+1, fine_y ) );
+	double sub_y = subPixel( cost( fine_x, fine_y-1 ), center, cost( fine_x, fine_y+1 ) );
+	
+	dx = ( fine_x + sub_x ) * 2;
+	dy = ( fine_y + sub_y ) * 2;
+	return true;
+}
+
+void Stabilise::translate( ffmpeg::Frame& frame, double dx, double dy ){
+	auto av_frame = frame.getFrame();
+	for( int p=0; p<3; p++ ){
+		auto plane = frame.getPlane( p );
+		double scale_x = double(plane.getWidth()) / frame.width();
+		double scale_y = double(plane.getHeight()) / frame.height();
+		if( frame.depth() > 8 )
+			shiftPlane( reinterpret_cast<uint16_t*>( av_frame->data[p] ), av_frame->linesize[p] / 2
+				,	plane.getWidth(), plane.getHeight(), dx * scale_x, dy * scale_y, buffer16 );
+		else
+			shiftPlane( av_frame->data[p], av_frame->linesize[p]
+				,	plane.getWidth(), plane.getHeight(), dx * scale_x, dy * scale_y, buffer );
+	}
+}
+
+void Stabilise::process( ffmpeg::Frame& frame ){
+	swap( current, previous );
+	auto stride = frame.getFrame()->linesize[0];
+	if( frame.depth() > 8 )
+		current[0].downscale( reinterpret_cast<const uint16_t*>( frame.constScanline( 0 ) )
+			,	frame.width(), frame.height(), stride / 2, frame.depth() - 8 );
+	else
+		current[0].downscale( frame.constScanline( 0 ), frame.width(), frame.height(), stride );
+	current[1].downscale( current[0].data.data(), current[0].width, current[0].height, current[0].width );
+	
+	double dx = 0.0, dy = 0.0;
+	if( has_previous && !estimate( dx, dy ) ){
+		//Start over after a cut
+		trajectory_x = trajectory_y = smooth_x = smooth_y = 0.0;
+	}
+	has_previous = true;
+	
+	trajectory_x += dx;
+	trajectory_y += dy;
+	smooth_x += smoothing * ( trajectory_x - smooth_x );
+	smooth_y += smoothing * ( trajectory_y - smooth_y );
+	
+	double correct_x = max( -max_shift, min( max_shift, trajectory_x - smooth_x ) );
+	double correct_y = max( -max_shift, min( max_shift, trajectory_y - smooth_y ) );
+	if( correct_x != 0.0 || correct_y != 0.0 )
+		translate( frame, correct_x, correct_y );
+}
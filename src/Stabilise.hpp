@@ -0,0 +1,67 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STABILISE_HPP
+#define STABILISE_HPP
+
+#include "ffmpeg.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+/* Removes the whole-frame wobble between frames. The global offset to the
+ * previous frame is found by block matching on a downscaled luma pyramid,
+ * the accumulated motion is low-pass filtered, and the frame is translated
+ * by the difference so only the smooth part of the motion remains. */
+class Stabilise{
+	private:
+		struct Level{
+			unsigned width{ 0 };
+			unsigned height{ 0 };
+			std::vector<uint8_t> data;
+			
+			const uint8_t* row( unsigned y ) const{ return data.data() + y * width; }
+			///Halves the size, reducing the samples to 8 bit by shift
+			template<typename Sample>
+			void downscale( const Sample* in, unsigned in_width, unsigned in_height, unsigned stride, unsigned shift=0 );
+		};
+		
+		///Half and quarter resolution, of this and the last frame
+		Level current[2];
+		Level previous[2];
+		bool has_previous{ false };
+		
+		double smoothing;
+		double max_shift;
+		double trajectory_x{ 0.0 }, trajectory_y{ 0.0 };
+		double smooth_x{ 0.0 }, smooth_y{ 0.0 };
+		
+		std::vector<uint8_t> buffer;
+		std::vector<uint16_t> buffer16;
+		
+		bool estimate( double& dx, double& dy ) const;
+		void translate( ffmpeg::Frame& frame, double dx, double dy );
+		
+	public:
+		///smoothing is the weight of the newest frame in the motion average
+		Stabilise( double smoothing, double max_shift=16.0 )
+			:	smoothing(smoothing), max_shift(max_shift) { }
+		
+		void process( ffmpeg::Frame& frame );
+};
+
+#endif
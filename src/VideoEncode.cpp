@@ -0,0 +1,424 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "VideoEncode.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+
+VideoEncode::~VideoEncode(){
+	sws_freeContext( scaler );
+	delete scaled;
+	if( context )
+		avcodec_close( context );
+	if( format ){
+		if( !(format->oformat->flags & AVFMT_NOFILE) && !writer )
+			avio_closep( &format->pb );
+		avformat_free_context( format );
+	}
+}
+
+void VideoEncode::addPassthrough( AVFormatContext* input, int video_stream ){
+	this->input = input;
+	stream_map.assign( input->nb_streams, -1 );
+	for( unsigned i=0; i<input->nb_streams; i++ )
+		if( (int)i != video_stream && input->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO )
+			stream_map[i] = -2; //Added when the output is opened
+}
+
+bool VideoEncode::open( AVRational frame_rate, unsigned width, unsigned height, AVPixelFormat pix_fmt ){
+	in_width = width;
+	in_height = height;
+	
+	auto name = settings.path.toLocal8Bit();
+	if( avformat_alloc_output_context2( &format, nullptr, nullptr, name.constData() ) < 0 || !format ){
+		cout << "Could not find a container for the output file" << endl;
+		return false;
+	}
+	
+	AVCodec* codec = avcodec_find_encoder_by_name( settings.codec.toLocal8Bit().constData() );
+	if( !codec ){
+		cout << "Could not find encoder " << settings.codec.toLocal8Bit().constData() << endl;
+		return false;
+	}
+	if( settings.cuttable && !closedGops( codec ) ){
+		cout << "Encoder " << codec->name << " can't start closed GOPs, checkpoints need libx264, mpeg2video or mpeg4" << endl;
+		return false;
+	}
+	
+	stream = avformat_new_stream( format, codec );
+	if( !stream )
+		return false;
+	context = stream->codec;
+	
+	context->width  = settings.width  ? settings.width  : width;
+	context->height = settings.height ? settings.height : height;
+	context->time_base = av_inv_q( frame_rate );
+	context->pix_fmt = pix_fmt;
+	stream->time_base = context->time_base;
+	
+//	context->bit_rate = 40000000;
+	context->gop_size = max( 1, int( av_q2d( frame_rate ) + 0.5 ) );
+	context->max_b_frames = 1;
+	if( settings.threads > 0 )
+		context->thread_count = settings.threads;
+	
+	//TODO: only interlaced
+	context->flags |= CODEC_FLAG_INTERLACED_ME | CODEC_FLAG_INTERLACED_DCT;
+	if( format->oformat->flags & AVFMT_GLOBALHEADER )
+		context->flags |= CODEC_FLAG_GLOBAL_HEADER;
+	av_opt_set( context->priv_data, "preset", settings.preset.toLocal8Bit().constData(), 0 );
+	if( settings.cuttable ){
+		//No frame after a forced keyframe may refer to one before it
+		context->flags |= CODEC_FLAG_CLOSED_GOP;
+		av_opt_set( context->priv_data, "forced-idr", "1", 0 );
+	}
+	
+	AVDictionary *outDict = nullptr;
+	av_dict_set( &outDict, "crf", settings.crf.toLocal8Bit().constData(), AV_DICT_APPEND );
+	
+	if( avcodec_open2( context, codec, &outDict ) < 0 ){
+		cout << "Could not open codec" << endl;
+		if( pix_fmt != AV_PIX_FMT_YUV420P )
+			cout << "The encoder might not support " << av_get_pix_fmt_name( pix_fmt ) << endl;
+		return false;
+	}
+	av_dict_free( &outDict );
+	
+	if( unsigned(context->width) != width || unsigned(context->height) != height ){
+		scaled = new ffmpeg::Frame( context->width, context->height, context->pix_fmt );
+		scaler = sws_getContext( width, height, pix_fmt
+			,	context->width, context->height, context->pix_fmt
+			,	SWS_BICUBIC, nullptr, nullptr, nullptr );
+		if( !scaler ){
+			cout << "Could not create scaler" << endl;
+			return false;
+		}
+	}
+	
+	//Copy the other streams without decoding
+	for( unsigned i=0; i<stream_map.size(); i++ ){
+		if( stream_map[i] != -2 )
+			continue;
+		stream_map[i] = -1;
+		
+		auto in = input->streams[i];
+		if( avformat_query_codec( format->oformat, in->codec->codec_id, FF_COMPLIANCE_NORMAL ) != 1 ){
+			cout << "Output container can't hold stream " << i << ", dropping it" << endl;
+			continue;
+		}
+		
+		auto out = avformat_new_stream( format, nullptr );
+		if( !out || avcodec_copy_context( out->codec, in->codec ) < 0 ){
+			cout << "Could not copy stream " << i << endl;
+			continue;
+		}
+		out->codec->codec_tag = 0;
+		if( format->oformat->flags & AVFMT_GLOBALHEADER )
+			out->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+		out->time_base = in->time_base;
+		av_dict_copy( &out->metadata, in->metadata, 0 );
+		stream_map[i] = out->index;
+	}
+	if( input )
+		av_dict_copy( &format->metadata, input->metadata, 0 );
+	
+	if( !(format->oformat->flags & AVFMT_NOFILE) ){
+		if( settings.io.async ){
+			writer.reset( new WriteBehind( settings.io ) );
+			if( writer->open( settings.path ) ){
+				format->pb = writer->avio();
+				format->flags |= AVFMT_FLAG_CUSTOM_IO;
+			}
+			else
+				writer.reset();
+		}
+		if( !format->pb && avio_open( &format->pb, name.constData(), AVIO_FLAG_WRITE ) < 0 ){
+			cout << "Could not open output file" << endl;
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+void VideoEncode::setRange( int64_t start, int64_t end ){
+	start_time = start;
+	end_time = end;
+}
+
+void VideoEncode::copyChapters(){
+	if( !input || input->nb_chapters == 0 )
+		return;
+	
+	format->chapters = (AVChapter**)av_mallocz( input->nb_chapters * sizeof(AVChapter*) );
+	for( unsigned i=0; i<input->nb_chapters; i++ ){
+		auto in = input->chapters[i];
+		int64_t offset = av_rescale_q( start_time, AV_TIME_BASE_Q, in->time_base );
+		int64_t end = end_time == INT64_MAX ? in->end : av_rescale_q( end_time, AV_TIME_BASE_Q, in->time_base );
+		
+		//Clip to the processed range
+		if( in->end <= offset || in->start >= end )
+			continue;
+		
+		auto out = (AVChapter*)av_mallocz( sizeof(AVChapter) );
+		out->id = in->id;
+		out->time_base = in->time_base;
+		out->start = max( in->start, offset ) - offset;
+		out->end = min( in->end, end ) - offset;
+		av_dict_copy( &out->metadata, in->metadata, 0 );
+		format->chapters[ format->nb_chapters++ ] = out;
+	}
+}
+
+///If a forced keyframe is sure to start a closed GOP, so no frame after it
+///refers to one before. libx264 makes it an IDR frame, the MPEG video
+///encoders honour CODEC_FLAG_CLOSED_GOP. Others may keep B frames or
+///references across it
+bool VideoEncode::closedGops( const AVCodec* codec ) const{
+	auto descriptor = avcodec_descriptor_get( codec->id );
+	if( descriptor && (descriptor->props & AV_CODEC_PROP_INTRA_ONLY) )
+		return true;
+	for( auto name : { "libx264", "libx264rgb", "mpeg1video", "mpeg2video", "mpeg4" } )
+		if( strcmp( codec->name, name ) == 0 )
+			return true;
+	return false;
+}
+
+bool VideoEncode::writeHeader(){
+	copyChapters();
+	if( avformat_write_header( format, nullptr ) < 0 ){
+		cout << "Could not write output header" << endl;
+		return false;
+	}
+	return true;
+}
+
+bool VideoEncode::startOutput(){
+	if( !header_written && !header_failed ){
+		header_written = writeHeader();
+		header_failed = !header_written;
+	}
+	return header_written;
+}
+
+bool VideoEncode::write( AVPacket& packet ){
+	lock_guard<mutex> guard( write_lock );
+	if( !startOutput() )
+		return false;
+	return av_interleaved_write_frame( format, &packet ) >= 0;
+}
+
+void VideoEncode::writeVideo( AVPacket& packet ){
+	//The forced keyframes start a closed GOP, so every frame before it is
+	//written by now and the output can be cut here
+	int64_t frame = 0;
+	auto cut = forced.find( packet.pts );
+	if( cut != forced.end() ){
+		frame = cut->second;
+		forced.erase( cut );
+	}
+	if( frame > 0 && (packet.flags & AV_PKT_FLAG_KEY) ){
+		lock_guard<mutex> guard( write_lock );
+		if( header_written && format->pb ){
+			av_interleaved_write_frame( format, nullptr );
+			avio_flush( format->pb );
+			//The checkpoint may only refer to data that is on the disk
+			if( writer ? !writer->sync() : !syncPath( settings.path ) )
+				cout << "Could not write " << settings.path.toLocal8Bit().constData() << endl;
+			cut_points.emplace_back( frame, avio_tell( format->pb ) );
+		}
+	}
+	
+	av_packet_rescale_ts( &packet, context->time_base, stream->time_base );
+	packet.stream_index = stream->index;
+	write( packet );
+	av_free_packet( &packet );
+}
+
+void VideoEncode::writePassthrough( AVPacket& packet ){
+	auto in = input->streams[packet.stream_index];
+	auto out = format->streams[ stream_map[packet.stream_index] ];
+	
+	//Only the part matching the processed video
+	int64_t time = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+	if( time != AV_NOPTS_VALUE ){
+		time = av_rescale_q( time, in->time_base, AV_TIME_BASE_Q );
+		if( time < start_time || time < resume_time || time >= end_time )
+			return;
+	}
+	
+	AVPacket copy;
+	if( av_copy_packet( &copy, &packet ) < 0 )
+		return;
+	
+	int64_t offset = av_rescale_q( start_time, AV_TIME_BASE_Q, out->time_base );
+	av_packet_rescale_ts( &copy, in->time_base, out->time_base );
+	if( copy.pts != AV_NOPTS_VALUE )
+		copy.pts -= offset;
+	if( copy.dts != AV_NOPTS_VALUE )
+		copy.dts -= offset;
+	copy.stream_index = out->index;
+	copy.pos = -1;
+	
+	write( copy );
+	av_free_packet( &copy );
+}
+
+void VideoEncode::setCheckpointInterval( int64_t interval ){
+	checkpoint_interval = settings.cuttable ? interval : 0;
+	//Keep MP4 readable if cut off
+	av_opt_set( format->priv_data, "movflags", "frag_keyframe+empty_moov", 0 );
+}
+
+int64_t VideoEncode::lastCutPoint(){
+	lock_guard<mutex> guard( write_lock );
+	return cut_points.empty() ? 0 : cut_points.back().first;
+}
+
+int64_t VideoEncode::cutPointBytes( int64_t frame ){
+	lock_guard<mutex> guard( write_lock );
+	for( auto& cut : cut_points )
+		if( cut.first == frame )
+			return cut.second;
+	return -1;
+}
+
+bool VideoEncode::resume( QString partial, int64_t frame, int64_t frame_time ){
+	if( frame_time == AV_NOPTS_VALUE ){
+		cout << "No timestamp to resume at" << endl;
+		return false;
+	}
+	
+	auto name = partial.toLocal8Bit();
+	AVFormatContext* old = nullptr;
+	if( avformat_open_input( &old, name.constData(), nullptr, nullptr ) < 0 ){
+		cout << "Could not open " << name.constData() << endl;
+		return false;
+	}
+	if( avformat_find_stream_info( old, nullptr ) < 0 || old->nb_streams != format->nb_streams ){
+		cout << name.constData() << " doesn't match the output settings" << endl;
+		avformat_close_input( &old );
+		return false;
+	}
+	
+	//The muxer may change the time bases when writing the header
+	{	lock_guard<mutex> guard( write_lock );
+		if( !startOutput() ){
+			avformat_close_input( &old );
+			return false;
+		}
+	}
+	
+	//Copy everything before the cut, the output starts at start_time
+	int64_t cut_time = frame_time - start_time;
+	int64_t cut_pts = av_rescale_q( cut_time, AV_TIME_BASE_Q, context->time_base );
+	AVPacket copy;
+	while( av_read_frame( old, &copy ) >= 0 ){
+		auto in = old->streams[copy.stream_index];
+		auto out = format->streams[copy.stream_index];
+		int64_t time = copy.pts != AV_NOPTS_VALUE ? copy.pts : copy.dts;
+		bool keep = time == AV_NOPTS_VALUE || ( out == stream
+			?	av_rescale_q( time, in->time_base, context->time_base ) < cut_pts
+			:	av_rescale_q( time, in->time_base, AV_TIME_BASE_Q ) < cut_time );
+		
+		if( keep ){
+			av_packet_rescale_ts( &copy, in->time_base, out->time_base );
+			copy.stream_index = out->index;
+			copy.pos = -1;
+			write( copy );
+		}
+		av_free_packet( &copy );
+	}
+	avformat_close_input( &old );
+	
+	index = frame;
+	last_pts = cut_pts - 1;
+	resume_time = frame_time;
+	return true;
+}
+
+void VideoEncode::saveFrame( AVFrame* frame, int64_t time ){
+	av_init_packet( &packet );
+	packet.data = nullptr;
+	packet.size = 0;
+	
+	//Encode from our own AVFrame, so pts can be set without touching the shared one
+	AVFrame* input = view.getFrame();
+	if( scaler ){
+		input = scaled->getFrame();
+		sws_scale( scaler, frame->data, frame->linesize, 0, frame->height, input->data, input->linesize );
+	}
+	else{
+		for( int i=0; i<AV_NUM_DATA_POINTERS; i++ ){
+			input->data[i] = frame->data[i];
+			input->linesize[i] = frame->linesize[i];
+		}
+		input->width = frame->width;
+		input->height = frame->height;
+		input->format = frame->format;
+	}
+	
+	//Timed as in the input, moved by start_time like the passthrough. Frames
+	//closer than the frame rate would share a timestamp, so are pushed apart
+	int64_t pts = last_pts + 1;
+	if( time != AV_NOPTS_VALUE )
+		pts = max( pts, av_rescale_q( time - start_time, AV_TIME_BASE_Q, context->time_base ) );
+	input->pts = last_pts = pts;
+	
+	//Checkpoints count frames, the timestamps of the input may have gaps
+	bool cut = checkpoint_interval > 0 && index % checkpoint_interval == 0;
+	input->pict_type = cut ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+	if( cut )
+		forced[pts] = index;
+	index++;
+	
+	int got_output = false;
+	avcodec_encode_video2( context, &packet, input, &got_output );
+	
+	if( got_output )
+		writeVideo( packet );
+}
+
+void VideoEncode::finish(){
+	{	lock_guard<mutex> guard( write_lock );
+		if( header_failed )
+			return; //Nothing can be written to it
+	}
+	
+	//Delayed frames
+	while( true ){
+		av_init_packet( &packet );
+		packet.data = nullptr;
+		packet.size = 0;
+		
+		int got_output = false;
+		if( avcodec_encode_video2( context, &packet, nullptr, &got_output ) < 0 || !got_output )
+			break;
+		writeVideo( packet );
+	}
+	
+	lock_guard<mutex> guard( write_lock );
+	if( header_written )
+		av_write_trailer( format );
+	if( writer && !writer->sync() )
+		cout << "Could not write " << settings.path.toLocal8Bit().constData() << endl;
+}
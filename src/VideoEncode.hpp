@@ -0,0 +1,131 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VIDEO_ENCODE_HPP
+#define VIDEO_ENCODE_HPP
+
+#include "ffmpeg.hpp"
+#include "AsyncIO.hpp"
+
+extern "C" {
+	#include <libswscale/swscale.h>
+}
+
+#include <QString>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+struct EncodeSettings{
+	QString path;
+	QString codec{ "libx264" };
+	QString preset{ "ultrafast" }; //TODO: set to slow
+	QString crf{ "18" };
+	unsigned width{ 0 };  ///0 to keep the processed size
+	unsigned height{ 0 };
+	int threads{ 0 };     ///Encoder threads, 0 for the library default
+	bool cuttable{ false }; ///Keyframes must start closed GOPs, for checkpoints
+	IoSettings io;
+};
+
+/* Encodes the processed frames and muxes them with the streams copied from
+ * the input. The header is written on the first packet, so the range can be
+ * set after opening. Packets may be written from several threads. */
+class VideoEncode{
+	private:
+		EncodeSettings settings;
+		AVFormatContext *format{ nullptr };
+		AVStream *stream{ nullptr };
+		AVCodecContext *context{ nullptr };
+		std::unique_ptr<WriteBehind> writer; ///Replaces the libavformat file access
+		unsigned in_width{ 0 }, in_height{ 0 }; ///Size of the processed frames
+		AVPacket packet;
+		int64_t index{ 0 };        ///Frames given to the encoder
+		int64_t last_pts{ -1 };    ///context->time_base, to keep them increasing
+		
+		//The processed frames are shared with other encoders and only read
+		ffmpeg::Frame view{ av_frame_alloc() };
+		SwsContext *scaler{ nullptr };
+		ffmpeg::Frame *scaled{ nullptr };
+		
+		//Passthrough of the other input streams
+		AVFormatContext *input{ nullptr };
+		std::vector<int> stream_map; ///Output stream for each input stream, -1 if dropped
+		int64_t start_time{ 0 };         ///AV_TIME_BASE units
+		int64_t end_time{ INT64_MAX };
+		
+		std::mutex write_lock;
+		bool header_written{ false };
+		bool header_failed{ false }; ///Nothing more is written then
+		
+		//Cutting points for resuming
+		int64_t checkpoint_interval{ 0 };
+		std::vector<std::pair<int64_t,int64_t>> cut_points; ///Frame starting a GOP, bytes written before it
+		std::map<int64_t,int64_t> forced; ///pts of the forced keyframes not written yet, to their frame
+		int64_t resume_time{ INT64_MIN }; ///Passthrough before this is already in the output
+		
+		bool closedGops( const AVCodec* codec ) const;
+		bool writeHeader();
+		///Writes the header if not done yet, write_lock must be held.
+		///Returns false if it failed, now or before
+		bool startOutput();
+		void copyChapters();
+		bool write( AVPacket& packet );
+		void writeVideo( AVPacket& packet );
+		
+	public:
+		VideoEncode( const EncodeSettings& settings ) : settings(settings) { }
+		~VideoEncode();
+		
+		///Copy the non-video streams, chapters and metadata of input
+		///Must be called before open()
+		void addPassthrough( AVFormatContext* input, int video_stream );
+		///The processed frames are of this size and format
+		bool open( AVRational frame_rate, unsigned width, unsigned height, AVPixelFormat pix_fmt );
+		
+		///Input time range being processed, AV_TIME_BASE units
+		void setRange( int64_t start, int64_t end );
+		
+		bool isPassthrough( int input_stream ) const{
+			return input_stream < (int)stream_map.size() && stream_map[input_stream] >= 0;
+		}
+		void writePassthrough( AVPacket& packet );
+		
+		///Start a GOP every interval frames, so the output can be cut there.
+		///Requires EncodeSettings::cuttable
+		void setCheckpointInterval( int64_t interval );
+		///The last frame the output can be cut at, 0 if none
+		int64_t lastCutPoint();
+		///Size of the output before frame, -1 if it is not a cutting point
+		int64_t cutPointBytes( int64_t frame );
+		///Copy everything before frame from partial, a previous output made
+		///with the same settings. Encoding continues at frame, which is at
+		///frame_time of the input in AV_TIME_BASE units
+		bool resume( QString partial, int64_t frame, int64_t frame_time );
+		
+		///frame is not modified. time is when it was in the input, in
+		///AV_TIME_BASE units, or AV_NOPTS_VALUE to follow the previous one
+		void saveFrame( AVFrame* frame, int64_t time );
+		///Flush delayed frames and finish the file
+		void finish();
+};
+
+#endif
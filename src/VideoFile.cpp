@@ -17,8 +17,20 @@
 
 #include "VideoFile.hpp"
 #include "VideoFrame.hpp"
+#include "Instrument.hpp"
+#include "BoundedQueue.hpp"
+#include "FrameProcessor.hpp"
+#include "Preview.hpp"
 
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
@@ -35,45 +47,25 @@ const char* media_type_to_text( AVMediaType t ){
 }
 
 
-bool VideoEncode::open(){
-	codec = avcodec_find_encoder( AV_CODEC_ID_H264 );
-	if( !codec )
-		return false;
-	
-	context = avcodec_alloc_context3( codec );
-	
-	context->width = 720;
-	context->height = 576;
-	context->time_base = (AVRational){ 1, 25 };
-	context->pix_fmt = AV_PIX_FMT_YUV420P;
-	
-//	context->bit_rate = 40000000;
-	context->gop_size = 25;
-	context->max_b_frames = 1;
-	
-	//TODO: only interlaced
-	context->flags |= CODEC_FLAG_INTERLACED_ME | CODEC_FLAG_INTERLACED_DCT;
-	av_opt_set( context->priv_data, "preset", "ultrafast", 0 ); //TODO: set to slow
-	
-	AVDictionary *outDict = nullptr;
-	av_dict_set( &outDict, "crf", "18", AV_DICT_APPEND );
-	
-	if( avcodec_open2( context, codec, &outDict ) < 0 ){
-		cout << "Could not open codec" << endl;
-		return false;
-	}
-	
-	f = fopen( filename, "wb" );
-	if( !f ){
-		cout << "Could not open output file" << endl;
-		return false;
-	}
-	
-	return true;
+VideoFile::~VideoFile(){
+	if( codec_context )
+		avcodec_close( codec_context );
+	if( format_context )
+		avformat_close_input( &format_context );
 }
 
-
-bool VideoFile::open(){
+bool VideoFile::open( const IoSettings& io ){
+	if( io.async ){
+		reader.reset( new ReadAhead( io ) );
+		if( reader->open( filepath ) ){
+			format_context = avformat_alloc_context();
+			format_context->pb = reader->avio();
+			format_context->flags |= AVFMT_FLAG_CUSTOM_IO;
+		}
+		else
+			reader.reset();
+	}
+	
 	if( avformat_open_input( &format_context
 		,	filepath.toLocal8Bit().constData(), nullptr, nullptr ) ){
 		cout << "Couldn't open file, either missing, unsupported or corrupted\n";
@@ -105,6 +97,7 @@ bool VideoFile::open(){
 		return false;
 	}
 	
+	buffers.install( codec_context );
 	if( avcodec_open2( codec_context, codec, nullptr ) < 0 ){
 		cout << "Couldn't open codec\n";
 		return false;
@@ -120,55 +113,383 @@ void VideoFile::debug_containter(){
 	}
 }
 
-bool VideoFile::seek( unsigned min, unsigned sec ){
-	int64_t target = av_rescale_q( min * 60 + sec, format_context->streams[stream_index]->time_base, AV_TIME_BASE_Q );
-	if( av_seek_frame( format_context, stream_index, target, AVSEEK_FLAG_ANY ) < 0 ){
+bool VideoFile::loadIndex(){
+	if( index.size() > 0 )
+		return true;
+	
+	QString path = filepath + ".vhsidx";
+	PacketIndex::Source source;
+	bool cacheable = PacketIndex::identify( filepath, source );
+	if( cacheable && index.load( path, source ) )
+		return true;
+	
+	cout << "Building packet index, this is only done once\n";
+	index.build( format_context, stream_index );
+	if( cacheable && !index.save( path, source ) )
+		cout << "Couldn't save packet index\n";
+	return index.size() > 0;
+}
+
+bool VideoFile::seekFrame( int64_t frame, int64_t& start_pts ){
+	if( !loadIndex() ){
+		cout << "Couldn't index file\n";
+		return false;
+	}
+	if( frame >= index.size() ){
+		cout << "Start is past the end of the file\n";
+		return false;
+	}
+	
+	auto key = max( index.keyframeBefore( frame ), int64_t(0) );
+	if( av_seek_frame( format_context, stream_index, index[key].pts, AVSEEK_FLAG_BACKWARD ) < 0 ){
 		cout << "Couldn't seek\n";
 		return false;
 	}
 	avcodec_flush_buffers( codec_context );
-	cout << "target: " << target << "\n";
+	flushing = false;
+	start_pts = index[frame].pts;
 	return true;
 }
 
+bool VideoFile::dropBeforeStart( ffmpeg::Frame& frame, int64_t& start_pts ){
+	if( start_pts == AV_NOPTS_VALUE )
+		return false;
+	
+	//Frames without a timestamp can't be placed, so they are kept
+	auto pts = frame.getFrame()->best_effort_timestamp;
+	if( pts != AV_NOPTS_VALUE && pts < start_pts )
+		return true;
+	if( pts != AV_NOPTS_VALUE && pts > start_pts )
+		cout << "Seeking landed after the start, output begins late\n";
+	start_pts = AV_NOPTS_VALUE;
+	return false;
+}
+
 bool VideoFile::seek( int64_t byte ){
 	if( av_seek_frame( format_context, stream_index, byte, AVSEEK_FLAG_BYTE ) < 0 ){
 		cout << "Couldn't seek\n";
 		return false;
 	}
 	avcodec_flush_buffers( codec_context );
-	cout << "target: " << byte << "\n";
+	flushing = false;
 	return true;
 }
 
-void VideoFile::run( VideoEncode& encode ){
-	VideoFrame output;
-	ffmpeg::Frame frame( av_frame_alloc() );
+bool VideoFile::resumeAt( int64_t frame, int64_t byte, int64_t& start_pts ){
+	int64_t target = range_start + frame;
+	if( !loadIndex() || target >= index.size() ){
+		cout << "Checkpoint is past the end of the file\n";
+		return false;
+	}
+	
+	//Byte seeking is exact for formats supporting it, but only trusted if
+	//the file still has the keyframe there
+	auto key = max( index.keyframeBefore( target ), int64_t(0) );
+	if( byte >= 0 && byte == index[key].pos && !(format_context->iformat->flags & AVFMT_NO_BYTE_SEEK) ){
+		start_pts = index[target].pts;
+		return seek( byte );
+	}
+	return seekFrame( target, start_pts );
+}
+
+int64_t VideoFile::inputPosition( int64_t frame ){
+	int64_t target = range_start + frame;
+	if( target >= index.size() )
+		return -1;
+	return index[ max( index.keyframeBefore( target ), int64_t(0) ) ].pos;
+}
+
+int64_t VideoFile::frameTime( ffmpeg::Frame& frame ) const{
+	auto pts = frame.getFrame()->best_effort_timestamp;
+	if( pts == AV_NOPTS_VALUE )
+		return AV_NOPTS_VALUE;
+	return av_rescale_q( pts, format_context->streams[stream_index]->time_base, AV_TIME_BASE_Q );
+}
+
+int64_t VideoFile::indexTime( int64_t frame ){
+	int64_t target = range_start + frame;
+	if( !loadIndex() || target >= index.size() || index[target].pts == AV_NOPTS_VALUE )
+		return AV_NOPTS_VALUE;
+	return av_rescale_q( index[target].pts, format_context->streams[stream_index]->time_base, AV_TIME_BASE_Q );
+}
+
+AVRational VideoFile::frameRateQ() const{
+	auto rate = format_context->streams[stream_index]->avg_frame_rate;
+	return ( rate.num > 0 && rate.den > 0 ) ? rate : (AVRational){ 25, 1 };
+}
+
+double VideoFile::frameRate() const{
+	return av_q2d( frameRateQ() );
+}
+
+unsigned VideoFile::frameCount() const{
+	auto stream = format_context->streams[stream_index];
+	if( stream->nb_frames > 0 )
+		return stream->nb_frames;
+	if( format_context->duration > 0 )
+		return format_context->duration * frameRate() / AV_TIME_BASE;
+	return 0;
+}
+
+unsigned VideoFile::depth() const{
+	return av_pix_fmt_desc_get( codec_context->pix_fmt )->comp[0].depth_minus1 + 1;
+}
+
+static double peakMemoryMb(){
+	rusage usage;
+	if( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return 0.0;
+	return usage.ru_maxrss / 1024.0; //kB on Linux
+}
+
+namespace{
+	///Pooled frame, shared read-only by all encoders once processed
+	struct PooledFrame{
+		VideoFrame frame;
+		ffmpeg::Frame source{ av_frame_alloc() }; ///Decoded, until converted in bands
+		int64_t time{ AV_NOPTS_VALUE }; ///Of the decoded frame, AV_TIME_BASE units
+		std::atomic<unsigned> users{ 0 };
+		
+		PooledFrame( unsigned width, unsigned height, unsigned head_switch, unsigned depth )
+			:	frame( width, height, head_switch, depth ) { }
+	};
+}
+
+bool VideoFile::startRange( const vector<VideoEncode*>& encoders, const Options& options
+	,	int64_t& start_pts, int64_t& limit, int64_t& total ){
+	if( !VideoFrame::canConvert( codec_context->pix_fmt ) ){
+		auto desc = av_pix_fmt_desc_get( codec_context->pix_fmt );
+		cout << "Unsupported pixel format: " << ( desc ? desc->name : "unknown" ) << "\n";
+		return false;
+	}
 	
+	double fps = frameRate();
+	int64_t first_frame = int64_t( options.start * fps + 0.5 );
+	limit = options.frameLimit( fps );
+	range_start = first_frame;
+	start_pts = AV_NOPTS_VALUE;
+	if( first_frame > 0 && !seekFrame( first_frame, start_pts ) )
+		return false;
+	
+	total = limit >= 0 ? limit : max( int64_t(frameCount()) - first_frame, int64_t(0) );
+	
+	//Keep the copied streams in sync with the processed range
+	auto stream = format_context->streams[stream_index];
+	int64_t range_pts = first_frame > 0 ? index[first_frame].pts : stream->start_time;
+	int64_t start_time = range_pts != AV_NOPTS_VALUE ? av_rescale_q( range_pts, stream->time_base, AV_TIME_BASE_Q ) : 0;
+	int64_t end_time = limit >= 0 ? start_time + av_rescale_q( limit, av_inv_q( frameRateQ() ), AV_TIME_BASE_Q ) : INT64_MAX;
+	for( auto encode : encoders )
+		encode->setRange( start_time, end_time );
+	return true;
+}
+
+bool VideoFile::readFrame( ffmpeg::Frame& frame, const vector<VideoEncode*>& encoders ){
 	AVPacket packet;
-	int frame_done;
-	int current = 0;
-	while( av_read_frame( format_context, &packet ) >= 0 ){
+	int frame_done = 0;
+	av_frame_unref( frame.getFrame() );
+	while( !flushing ){
+		if( av_read_frame( format_context, &packet ) < 0 ){
+			flushing = true;
+			break;
+		}
+		
 		if( packet.stream_index == stream_index ){
+			INSTRUMENT_SCOPE( DECODE );
 			avcodec_decode_video2( codec_context, frame.getFrame(), &frame_done, &packet );
+		}
+		else
+			for( auto encode : encoders )
+				if( encode->isPassthrough( packet.stream_index ) )
+					encode->writePassthrough( packet );
+		av_free_packet( &packet );
+		
+		if( frame_done )
+			return true;
+	}
+	
+	//Get the frames delayed in the decoder
+	av_init_packet( &packet );
+	packet.data = nullptr;
+	packet.size = 0;
+	INSTRUMENT_SCOPE( DECODE );
+	avcodec_decode_video2( codec_context, frame.getFrame(), &frame_done, &packet );
+	return frame_done;
+}
+
+void VideoFile::run( const vector<VideoEncode*>& encoders, const Options& options, Checkpoint* checkpoint ){
+	int64_t start_pts, limit, total;
+	if( !startRange( encoders, options, start_pts, limit, total ) )
+		return;
+	double fps = frameRate();
+	
+	if( checkpoint ){
+		for( auto encode : encoders )
+			encode->setCheckpointInterval( max( int64_t(1), int64_t( options.checkpoint * fps + 0.5 ) ) );
+		
+		//The frames before the checkpoint are copied from the old outputs
+		if( checkpoint->frame > 0 ){
+			if( !resumeAt( checkpoint->frame, checkpoint->input_pos, start_pts ) )
+				return;
+			for( unsigned i=0; i<encoders.size(); i++ )
+				if( !encoders[i]->resume( checkpoint->partialOutput( i ), checkpoint->frame, indexTime( checkpoint->frame ) ) )
+					return;
 			
-			if( frame_done ){
-			//	cout << "start frame" << endl;
-				output.initFrame( frame );
-				output.process();
-				
-				encode.saveFrame( output.getFrame() );
-				current++;
-				if( current % 25 == 0 )
-					cout << "Time: " << current / 25 << "s\n";
-				
-				if( current == 400 )
-					break;
+			cout << "Resuming at frame " << checkpoint->frame << "\n";
+			if( limit >= 0 )
+				limit = max( limit - checkpoint->frame, int64_t(0) );
+			total = max( total - checkpoint->frame, int64_t(0) );
+		}
+		//The index is needed for the input positions
+		else if( range_start == 0 && !seekFrame( 0, start_pts ) )
+			return;
+	}
+	
+	//The frame pool is the hard limit on memory use, the queues between the
+	//stages only get part of it so a slow stage blocks the one before it
+	//Without preview the decoded frame is held until it is converted together
+	//with the processing, so it is part of each pooled frame
+	bool bands = options.preview == 0;
+	size_t frame_size = av_image_get_buffer_size( VideoFrame::formatFor( depth() ), width(), height(), 32 );
+	if( bands )
+		frame_size += av_image_get_buffer_size( codec_context->pix_fmt, width(), height(), 32 );
+	unsigned pool_size = max( size_t(4 + options.preview), options.max_memory / frame_size );
+	unsigned queue_size = max( 1u, (pool_size - 2) / 2 );
+	
+	vector<unique_ptr<PooledFrame>> pool;
+	BoundedQueue<PooledFrame*> free_frames( pool_size ), to_process( queue_size );
+	for( unsigned i=0; i<pool_size; i++ ){
+		pool.emplace_back( new PooledFrame( width(), height(), options.head_switch, depth() ) );
+		free_frames.push( pool.back().get() );
+	}
+	
+	//Every encoder gets the same frames, which are returned to the pool
+	//once the last one is done with it
+	vector<unique_ptr<BoundedQueue<PooledFrame*>>> to_encode;
+	for( unsigned i=0; i<encoders.size(); i++ )
+		to_encode.emplace_back( new BoundedQueue<PooledFrame*>( queue_size ) );
+	
+	FrameProcessor processing( options );
+	thread processor( [&](){
+		auto send = [&]( PooledFrame* output ){
+			output->users = encoders.size();
+			for( auto& queue : to_encode )
+				queue->push( output );
+		};
+		
+		//Previews hold frames back until they can be interpolated
+		Preview preview( processing, max( 1u, options.preview ) );
+		vector<PooledFrame*> held;
+		
+		PooledFrame* output;
+		while( to_process.pop( output ) ){
+			if( bands ){
+				processing.process( output->frame, output->source );
+				send( output );
+				continue;
 			}
 			
+			held.push_back( output );
+			if( preview.add( output->frame ) ){
+				for( auto frame : held )
+					send( frame );
+				held.clear();
+			}
 		}
-		av_free_packet( &packet );
+		preview.flush();
+		for( auto frame : held )
+			send( frame );
+		
+		for( auto& queue : to_encode )
+			queue->close();
+	} );
+	
+	//Saved once every output has passed the same cutting point
+	mutex checkpoint_lock;
+	auto saveCheckpoint = [&](){
+		lock_guard<mutex> guard( checkpoint_lock );
+		int64_t frame = INT64_MAX;
+		for( auto encode : encoders )
+			frame = min( frame, encode->lastCutPoint() );
+		if( frame <= checkpoint->frame )
+			return;
+		
+		vector<int64_t> bytes;
+		for( auto encode : encoders )
+			bytes.push_back( encode->cutPointBytes( frame ) );
+		if( find( bytes.begin(), bytes.end(), -1 ) != bytes.end() )
+			return;
+		
+		checkpoint->frame = frame;
+		checkpoint->input_pos = inputPosition( frame );
+		checkpoint->output_bytes = bytes;
+		if( !checkpoint->save() )
+			cout << "Could not save checkpoint\n";
+	};
+	
+	unsigned report_interval = max( 1, int( fps + 0.5 ) );
+	vector<thread> encoder_threads;
+	for( unsigned i=0; i<encoders.size(); i++ )
+		encoder_threads.emplace_back( [&,i](){
+			instrument::Progress progress( total, fps );
+			PooledFrame* output;
+			unsigned current = 0;
+			int64_t last_cut = 0;
+			while( to_encode[i]->pop( output ) ){
+				{	INSTRUMENT_SCOPE( ENCODE );
+					encoders[i]->saveFrame( output->frame.getFrame(), output->time );
+				}
+				if( checkpoint && encoders[i]->lastCutPoint() > last_cut ){
+					last_cut = encoders[i]->lastCutPoint();
+					saveCheckpoint();
+				}
+				if( --output->users == 0 )
+					free_frames.push( output );
+				
+				//Only the first encoder reports
+				if( i == 0 ){
+					INSTRUMENT_COUNT( FRAMES, 1 );
+					if( ++current % report_interval == 0 )
+						progress.report( current );
+				}
+			}
+		} );
+	
+	//Demux and decode on this thread
+	ffmpeg::Frame frame( av_frame_alloc() );
+	int64_t current = 0;
+	while( current != limit && readFrame( frame, encoders ) ){
+		if( dropBeforeStart( frame, start_pts ) )
+			continue;
+		
+		PooledFrame* output;
+		free_frames.pop( output );
+		output->time = frameTime( frame );
+		if( bands )
+			output->source.takeFrom( frame );
+		else{
+			INSTRUMENT_SCOPE( INIT );
+			output->frame.initFrame( frame );
+		}
+		to_process.push( output );
+		current++;
 	}
 	
+	to_process.close();
+	processor.join();
+	for( auto& encoder : encoder_threads )
+		encoder.join();
+	for( auto encode : encoders )
+		encode->finish();
+	if( checkpoint )
+		checkpoint->remove();
+	
+	cout << "Duplicate frames reused: " << processing.duplicateCount() << "\n";
+	cout << "Frame pool: " << pool_size << " frames, peak memory " << peakMemoryMb() << " MB\n";
+	cout << "Stalls (ms): decode waiting for frames " << free_frames.popStallMs()
+		<< ", decode blocked " << to_process.pushStallMs()
+		<< ", process waiting " << to_process.popStallMs();
+	for( unsigned i=0; i<to_encode.size(); i++ )
+		cout << ", process blocked by encoder " << i << " " << to_encode[i]->pushStallMs()
+			<< ", encoder " << i << " waiting " << to_encode[i]->popStallMs();
+	cout << "\n";
 }
-
@@ -19,60 +19,35 @@
 #define VIDEO_FILE_HPP
 
 #include "ffmpeg.hpp"
+#include "Options.hpp"
+#include "VideoEncode.hpp"
+#include "PacketIndex.hpp"
+#include "Checkpoint.hpp"
+#include "DecodePool.hpp"
+#include "AsyncIO.hpp"
 
 #include <QString>
 
-#include <cstdio>
+#include <memory>
 #include <stdint.h>
+#include <vector>
 
 
-class VideoEncode{
-	private:
-		const char* filename;
-		AVCodec *codec{ nullptr };
-		AVCodecContext *context{ nullptr };
-		AVPacket packet;
-		int index{ 0 };
-		std::FILE *f;
-		
-	public:
-		VideoEncode( const char* filename ) : filename(filename) {
-		}
-		
-		~VideoEncode(){
-			uint8_t endcode[] = { 0, 0, 1, 0xb7 };
-			std::fwrite( endcode, 1, sizeof(endcode), f );
-			std::fclose(f);
-		}
-		
-		bool open();
-		
-		void saveFrame( AVFrame* frame ){
-			av_init_packet( &packet );
-			packet.data = nullptr;
-			packet.size = 0;
-			
-			frame->pts = index++;
-			
-			int got_output = false;
-			avcodec_encode_video2( context, &packet, frame, &got_output );
-			
-			if( got_output ){
-				std::fwrite( packet.data, 1, packet.size, f );
-				av_free_packet( &packet );
-			}
-		}
-};
-
 class VideoFile{
 	private:
 		QString filepath;
 		AVFormatContext* format_context;
 		AVCodecContext* codec_context;
 		AVPacket packet;
+		DecodePool buffers;
+		std::unique_ptr<ReadAhead> reader; ///Replaces the libavformat file access
 		
 		int stream_index;
+		PacketIndex index;
+		bool flushing{ false }; ///Input is read, only draining the decoder
+		int64_t range_start{ 0 }; ///First frame to process, set by startRange
 		
+		bool loadIndex();
 		
 	public:
 		VideoFile( QString filepath )
@@ -80,11 +55,48 @@ class VideoFile{
 			,	format_context( nullptr )
 			,	codec_context( nullptr )
 			{ }
+		~VideoFile();
 		
-		bool open();
-		bool seek( unsigned min, unsigned sec );
+		bool open( const IoSettings& io=IoSettings() );
+		///Seek to the keyframe before frame, start_pts is set to the timestamp
+		///of frame, for dropBeforeStart()
+		bool seekFrame( int64_t frame, int64_t& start_pts );
 		bool seek( int64_t byte );
-		void run( VideoEncode& encode );
+		///Seek to frame of the range, preferring the keyframe at byte
+		bool resumeAt( int64_t frame, int64_t byte, int64_t& start_pts );
+		///If a decoded frame comes before start_pts after seeking. The first
+		///one that doesn't clears start_pts, as the demuxer may have landed on
+		///another keyframe or the GOP may be open
+		bool dropBeforeStart( ffmpeg::Frame& frame, int64_t& start_pts );
+		///Byte position of the keyframe before frame of the range
+		int64_t inputPosition( int64_t frame );
+		///Timestamp of a decoded frame in AV_TIME_BASE units, AV_NOPTS_VALUE if unknown
+		int64_t frameTime( ffmpeg::Frame& frame ) const;
+		///Timestamp of frame of the range from the index, as frameTime()
+		int64_t indexTime( int64_t frame );
+		double frameRate() const;
+		AVRational frameRateQ() const;
+		unsigned frameCount() const;
+		unsigned width() const{ return codec_context->width; }
+		unsigned height() const{ return codec_context->height; }
+		///Bits per sample of the decoded video
+		unsigned depth() const;
+		
+		///Seeks to the range in options and passes it on to the encoders.
+		///start_pts is for dropBeforeStart(), limit the amount of frames to
+		///process (-1 for all) and total the expected amount
+		bool startRange( const std::vector<VideoEncode*>& encoders, const Options& options
+			,	int64_t& start_pts, int64_t& limit, int64_t& total );
+		///Decodes the next frame, copying the packets of the other streams
+		///to the encoders. Returns false at the end of the input.
+		///frame is reference counted and may be taken over until the next call
+		bool readFrame( ffmpeg::Frame& frame, const std::vector<VideoEncode*>& encoders );
+		///Saves checkpoints if enabled in options, resuming from checkpoint
+		///if it was loaded
+		void run( const std::vector<VideoEncode*>& encoders, const Options& options, Checkpoint* checkpoint=nullptr );
+		
+		AVFormatContext* formatContext(){ return format_context; }
+		int streamIndex() const{ return stream_index; }
 		void debug_containter();
 };
 
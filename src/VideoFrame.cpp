@@ -16,337 +16,409 @@
 */
 
 #include "VideoFrame.hpp"
+#include "DecodePool.hpp"
+#include "VideoLine.hpp"
+#include "Instrument.hpp"
 
 #include "dump/DumpPlane.hpp"
 
-using namespace std;
-
-class VideoLine{
-	private:
-		uint8_t* data;
-		uint32_t width;
-		
-	public:
-		VideoLine( VideoFrame& frame, unsigned y ){
-			data = frame.scanline( y );
-			width = frame.width();
-		}
-		
-		VideoLine( vector<uint8_t>& buffer ){
-			data = buffer.data();
-			width = buffer.size();
-		}
-		
-		uint32_t getWidth() const{ return width; }
+#include <algorithm>
+#include <cmath>
 
-		uint8_t& operator[]( unsigned x ){ return data[x]; }
-		const uint8_t& operator[]( unsigned x ) const{ return data[x]; }
-};
+using namespace std;
 
-double cubic( double b, double c, double x ){
-	x = abs( x );
+void swapLine( const VideoFrame& p, VideoFrame& out, unsigned y, unsigned y_out ){
+	auto row1 = p.constScanline( y );
+	auto row2 = out.scanline( y_out );
 	
-	if( x < 1 )
-		return
-				(12 - 9*b - 6*c)/6 * x*x*x
-			+	(-18 + 12*b + 6*c)/6 * x*x
-			+	(6 - 2*b)/6
-			;
-	else if( x < 2 )
-		return
-				(-b - 6*c)/6 * x*x*x
-			+	(6*b + 30*c)/6 * x*x
-			+	(-12*b - 48*c)/6 * x
-			+	(8*b + 24*c)/6
-			;
-	else
-		return 0;
-}
-
-double scale_func( double x ){
-	return cubic( 1.0/3, 1.0/3, x );
+	for( unsigned ix=0; ix<p.width(); ix++ )
+		row2[ix] = row1[ix];
 }
 
-
-void scaleLineEx( const VideoLine& p, double x_scale, vector<uint8_t>& data ){
-	unsigned width = unsigned(p.getWidth() * x_scale);
-	data.resize( width );
-	
-	for( unsigned ix=0; ix<data.size(); ix++ ){
-		double pos = ix * (p.getWidth()-1) / ((p.getWidth()-1) * x_scale);
-		int left = floor( pos - 2 );
-		unsigned right = ceil( pos + 2 );
-		
-		//Limit
-		left = max( left, 0 );
-		right = min( right, p.getWidth() );
-		
-		double sum = 0.0;
-		double amount = 0.0;
-		for( unsigned jx=left; jx<=right; jx++ ){
-			double w = scale_func( jx - pos );
-			sum += w * p[jx];
-			amount += w;
+DumpPlane& blurFrames( DumpPlane& p ){
+	for( unsigned iy=0; iy<p.getHeight(); iy+=2 ){
+		auto row1 = p.scanline( iy );
+		auto row2 = p.scanline( iy+1 );
+		for( unsigned ix=0; ix<p.getWidth(); ix++ ){
+			auto mid = (row1[ix] + row2[ix]) / 2;
+			row1[ix] = row2[ix] = mid;
 		}
-		data[ix] = sum / amount;
 	}
+	
+	return p;
 }
 
-vector<uint8_t> scaleLine( const VideoLine& p, double x_scale ){
-	vector<uint8_t> data;
-	scaleLineEx( p, x_scale, data );
-	return data;
+
+VideoFrame::VideoFrame( unsigned width, unsigned height, unsigned head_switch, unsigned depth )
+	:	ffmpeg::Frame( width, height, formatFor( depth ) ) {
+	//8 lines for PAL, 6 for NTSC. Kept even so both fields are handled alike
+	if( head_switch == 0 )
+		head_switch = max( 2u, height / 72 );
+	this->head_switch = (head_switch + 1) & ~1u;
 }
 
-vector<uint8_t> scaleLine( VideoFrame& frame, unsigned y, double x_scale ){
-	VideoLine p( frame, y );
-	return scaleLine( p, x_scale );
+bool VideoFrame::canConvert( AVPixelFormat format ){
+	auto desc = av_pix_fmt_desc_get( format );
+	if( !desc || desc->nb_components < 3 || (desc->flags & (AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_RGB)) )
+		return false;
+	//Only half of each row is read for chroma, and one or two rows of it
+	if( desc->log2_chroma_w != 1 || desc->log2_chroma_h > 1 )
+		return false;
+	
+	//Planar, the chroma as UV pairs (NV12, P010) or all packed in one plane
+	//(YUYV, UYVY). The samples are read with the step of each component
+	auto& luma = desc->comp[0];
+	auto& u = desc->comp[1];
+	auto& v = desc->comp[2];
+	unsigned sample = luma.depth_minus1 < 8 ? 1 : 2;
+	auto step = [sample]( const AVComponentDescriptor& comp, unsigned samples ){
+		return comp.step_minus1 + 1u == sample * samples;
+	};
+	bool planar = u.plane != v.plane && step( luma, 1 ) && step( u, 1 ) && step( v, 1 );
+	bool interleaved = u.plane == v.plane && u.plane != luma.plane && step( luma, 1 ) && step( u, 2 ) && step( v, 2 );
+	bool packed = luma.plane == u.plane && u.plane == v.plane && desc->log2_chroma_h == 0
+		&& step( luma, 2 ) && step( u, 4 ) && step( v, 4 );
+	return (planar || interleaved || packed) && luma.depth_minus1 + 1u + luma.shift <= sample * 8;
 }
 
-void scaleLineEx( VideoFrame& frame, unsigned y, double x_scale, vector<uint8_t>& data ){
-	VideoLine p( frame, y );
-	scaleLineEx( p, x_scale, data );
+bool VideoFrame::canTakeOver( ffmpeg::Frame& newFrame ){
+	//Not if the decoder keeps it as a reference for later frames
+	auto frame = newFrame.getFrame();
+	if( newFrame.format() != format() || newFrame.width() != width() || newFrame.height() != height()
+		|| !av_frame_is_writable( frame ) )
+		return false;
+	
+	//The kernels rely on the aligned rows and the padding of the pool
+	for( int i=0; i<3; i++ )
+		if( frame->linesize[i] % 32 != 0 )
+			return false;
+	return DecodePool::owns( frame );
 }
 
+void VideoFrame::initFrame( ffmpeg::Frame& newFrame ){
+	//Decoded directly in the working format, so take over its buffers
+	if( canTakeOver( newFrame ) )
+		takeFrom( newFrame );
+	else
+		convertLines( newFrame, 0, height() );
+}
 
-vector<uint8_t> scaleLineDown( const VideoLine& p, double x_scale ){
-	x_scale = 1.0 / x_scale;
-	unsigned width = unsigned(p.getWidth() * x_scale);
-	vector<uint8_t> data( width, 0 ); //TODO: same as upscale
+void VideoFrame::convertLines( ffmpeg::Frame& newFrame, unsigned first, unsigned last ){
+	if( getDepth() > 8 ){
+		initHighDepth( newFrame, first, last );
+		return;
+	}
 	
-	for( unsigned ix=0; ix<data.size(); ix++ ){
-		unsigned left_big = max( ix, 2u ) - 2;
-		unsigned right_big = min( ix+2, p.getWidth()-1 );
+	//Copy luma
+	auto luma_out = getPlane( 0 );
+	auto luma_in = newFrame.getPlane( 0 );
+	for( unsigned iy=first; iy<last; iy++ ){
+		auto in = luma_in[iy];
+		auto out_l = luma_out[iy];
 		
-		//Scale
-		unsigned left = left_big * (p.getWidth()-1) / (data.size()-1);
-		unsigned right = right_big * (p.getWidth()-1) / (data.size()-1);
-		double center = ix * (p.getWidth()-1.0) / (data.size()-1.0);
+		for( unsigned ix=0; ix<in.size(); ix++ )
+			out_l[ix] = in[ix];
+	}
+	
+	//Blend the halved chroma to quartered chroma, quartered is copied
+	unsigned step = av_pix_fmt_desc_get( newFrame.format() )->log2_chroma_h ? 1 : 2;
+	for( int plane=1; plane<=2; plane++ ){
+		auto in_plane = newFrame.getPlane( plane );
+		auto out_plane = getPlane( plane );
 		
-		double sum = 0.0;
-		double amount = 0.0;
-		for( unsigned jx=left; jx<=right; jx++ ){
-			double w = scale_func( (jx - center)*x_scale );
-			sum += w * p[jx];
-			amount += w;
+		for( unsigned iy=first/2; iy<last/2; iy++ ){
+			auto in = in_plane[iy*step], in2 = in_plane[iy*step + step-1];
+			auto out = out_plane[iy];
+			for( unsigned ix=0; ix<out.size(); ix++ )
+				out[ix] = (in[ix] + in2[ix]) / 2;
 		}
-		data[ix] = sum / amount;
+	}
+}
+
+void VideoFrame::initHighDepth( ffmpeg::Frame& newFrame, unsigned first, unsigned last ){
+	//Input of any depth scaled to 10 bit. The components give where the
+	//samples are, as P010 has them MSB aligned and U and V interleaved
+	auto desc = av_pix_fmt_desc_get( newFrame.format() );
+	int shift = int(newFrame.depth()) - 10;
+	//Rounding takes full scale of deeper sources to 1024, past what the kernels expect
+	auto convert = [shift]( unsigned value ) -> uint16_t{
+		return shift >= 0 ? min( 1023u, ( value + ((1u << shift) >> 1) ) >> shift ) : value << -shift;
+	};
+	auto in = newFrame.getFrame();
+	auto out = getFrame();
+	auto row = [&]( const AVComponentDescriptor& comp, unsigned y ){
+		return reinterpret_cast<const uint16_t*>( in->data[comp.plane] + y * in->linesize[comp.plane] + comp.offset_plus1 - 1 );
+	};
+	
+	auto& luma = desc->comp[0];
+	unsigned luma_stride = (luma.step_minus1 + 1) / 2;
+	for( unsigned iy=first; iy<last; iy++ ){
+		auto row_in = row( luma, iy );
+		auto row_out = reinterpret_cast<uint16_t*>( out->data[0] + iy * out->linesize[0] );
+		for( unsigned ix=0; ix<width(); ix++ )
+			row_out[ix] = convert( row_in[ix*luma_stride] >> luma.shift );
 	}
 	
-	return data;
+	//4:2:2 chroma is blended, with rounding, 4:2:0 is copied
+	unsigned chroma_width = width() / 2;
+	unsigned step = desc->log2_chroma_h ? 1 : 2;
+	for( int plane=1; plane<=2; plane++ ){
+		auto& comp = desc->comp[plane];
+		unsigned stride = (comp.step_minus1 + 1) / 2;
+		for( unsigned iy=first/2; iy<last/2; iy++ ){
+			auto row1 = row( comp, iy*step );
+			auto row2 = row( comp, iy*step + step-1 );
+			auto row_out = reinterpret_cast<uint16_t*>( out->data[plane] + iy * out->linesize[plane] );
+			for( unsigned ix=0; ix<chroma_width; ix++ )
+				row_out[ix] = convert( ( (row1[ix*stride] >> comp.shift) + (row2[ix*stride] >> comp.shift) + 1 ) / 2 );
+		}
+	}
 }
 
-vector<uint8_t> scaleLineDown( vector<uint8_t>& p, double x_scale ){
-	VideoLine line( p );
-	return scaleLineDown( line, x_scale );
+void VideoFrame::process(){
+//	separateFrames();
+	fixFrameAlignment();
+	fixBottom();
 }
 
-unsigned diffLines( const VideoLine& p1, const VideoLine& p2, int dx ){
-	unsigned sum=0;
-	for( unsigned ix=0; ix<p1.getWidth(); ix++ ){
-		unsigned pos = unsigned(ix+dx+p2.getWidth()) % p2.getWidth();
-		auto error = abs( (int)p1[ix] - (int)p2[pos] );
-		sum += error;
+//Both searches only read lines the corrections don't change, so all of the
+//frame can be analysed before anything is applied
+void VideoFrame::analyse( FrameCorrection& correction, unsigned decimate ){
+	{	INSTRUMENT_SCOPE( ALIGNMENT );
+		if( getDepth() > 8 )
+			analyseAlignment<uint16_t>( correction.shifts, decimate );
+		else
+			analyseAlignment<uint8_t>( correction.shifts, decimate );
+	}
+	{	INSTRUMENT_SCOPE( BOTTOM );
+		if( getDepth() > 8 )
+			analyseBottom<uint16_t>( correction, decimate );
+		else
+			analyseBottom<uint8_t>( correction, decimate );
 	}
-	
-	return sum;
 }
 
-
-pair<unsigned,int> recursiveDiff( const VideoLine& p1, const VideoLine& p2, int left, int right ){
-	if( right - left <= 1 )
-		return make_pair( diffLines( p1, p2, left ), left );
-	else{
-	//	cout << "In: " << left << " - " << right << endl;
-		auto middle = (right - left) / 2 + left;
-		auto newLeft = (middle - left) / 2 + left;
-		auto newRight = (right - middle) / 2 + middle;
-		
-	//	cout << "Out: " << newLeft << " - " << newRight << endl;
-		auto leftVal  = diffLines( p1, p2, newLeft );
-		auto rightVal = diffLines( p1, p2, newRight );
-		
-		if( leftVal < rightVal )
-			return recursiveDiff( p1, p2, left, middle );
+void VideoFrame::apply( const FrameCorrection& correction ){
+	{	INSTRUMENT_SCOPE( ALIGNMENT );
+		if( getDepth() > 8 )
+			applyAlignment<uint16_t>( correction.shifts );
 		else
-			return recursiveDiff( p1, p2, middle, right );
+			applyAlignment<uint8_t>( correction.shifts );
+	}
+	{	INSTRUMENT_SCOPE( BOTTOM );
+		if( getDepth() > 8 )
+			applyBottom<uint16_t>( correction );
+		else
+			applyBottom<uint8_t>( correction );
 	}
 }
 
-/*
-bool bestDiffEx( const VideoLine& p1, const VideoLine& p2, int& best_x2, unsigned& best_val, int amount=10 ){
-	bool improved = false;
-	
-	unsigned best = -1;
-	int best_x = -1;
-	for( int dx=-amount; dx<=amount; dx++ ){
-		auto current = diffLines( p1, p2, dx );
-		if( current < best ){
-			best = current;
-			best_x = dx;
-		}
+void VideoFrame::fixFrameAlignment(){
+	INSTRUMENT_SCOPE( ALIGNMENT );
+	vector<int> shifts;
+	if( getDepth() > 8 ){
+		analyseAlignment<uint16_t>( shifts, 1 );
+		applyAlignment<uint16_t>( shifts );
 	}
-	
-	if( best < best_val ){
-		improved = true;
-		best_val = best;
-		best_x2 = best_x;
+	else{
+		analyseAlignment<uint8_t>( shifts, 1 );
+		applyAlignment<uint8_t>( shifts );
 	}
-	return improved;
 }
-/*/
-bool bestDiffEx( const VideoLine& p1, const VideoLine& p2, int& best_x2, unsigned& best_val, int amount=10 ){
-	auto result = recursiveDiff( p1, p2, -amount, amount );
-	if( result.first < best_val ){
-		best_x2 = result.second;
-		best_val = result.first;
-		return true;
+
+void VideoFrame::fixBottom(){
+	INSTRUMENT_SCOPE( BOTTOM );
+	FrameCorrection correction;
+	if( getDepth() > 8 ){
+		analyseBottom<uint16_t>( correction, 1 );
+		applyBottom<uint16_t>( correction );
+	}
+	else{
+		analyseBottom<uint8_t>( correction, 1 );
+		applyBottom<uint8_t>( correction );
 	}
-	return false;
 }
-//*/
 
-int bestDiff( vector<uint8_t>& line1, vector<uint8_t>& line2, int amount ){
-	VideoLine l1( line1 ), l2( line2 );
-	
-	unsigned best_val = -1;
-	int best_x = 0;
-	bestDiffEx( l1, l2, best_x, best_val, amount );
-	return best_x;
+FrameCorrection FrameCorrection::interpolate( const FrameCorrection& a, const FrameCorrection& b, double t ){
+	auto blend = [t]( double x, double y ){ return x + (y - x) * t; };
+	FrameCorrection result = a;
+	for( unsigned i=0; i<result.shifts.size() && i<b.shifts.size(); i++ )
+		result.shifts[i] = int( floor( blend( a.shifts[i], b.shifts[i] ) + 0.5 ) );
+	for( unsigned i=0; i<result.bottom_shifts.size() && i<b.bottom_shifts.size(); i++ ){
+		result.bottom_shifts[i] = int( floor( blend( a.bottom_shifts[i], b.bottom_shifts[i] ) + 0.5 ) );
+		result.bottom_scales[i] = blend( a.bottom_scales[i], b.bottom_scales[i] );
+	}
+	return result;
 }
 
-void moveLine( VideoLine& p, VideoLine& out, int dx ){
-	for( unsigned ix=0; ix<out.getWidth(); ix++ ){
-		unsigned pos = unsigned(ix+dx+p.getWidth()) % p.getWidth();
-		out[ix] = p[pos];
+///Copy of line y for searching, averaged down horizontally by decimate
+template<typename Sample>
+static vector<Sample> searchLine( VideoFrame& frame, unsigned y, unsigned decimate ){
+	BasicVideoLine<Sample> line( frame, y );
+	if( decimate <= 1 )
+		return vector<Sample>( line.begin(), line.begin() + line.getWidth() );
+	
+	vector<Sample> small( line.getWidth() / decimate );
+	for( unsigned ix=0; ix<small.size(); ix++ ){
+		unsigned sum = 0;
+		for( unsigned i=0; i<decimate; i++ )
+			sum += line[ix*decimate + i];
+		small[ix] = (sum + decimate/2) / decimate;
 	}
+	return small;
 }
 
-void moveLine( vector<uint8_t>& p, vector<uint8_t>& out, int dx ){
-	VideoLine p1( p ), out1( out );
-	moveLine( p1, out1, dx );
+template<typename Sample>
+static vector<Sample> searchLine( VideoFrame& frame, unsigned y, double scale, unsigned decimate ){
+	auto line = searchLine<Sample>( frame, y, decimate );
+	return scaleLine( BasicVideoLine<Sample>( line ), scale, frame.maxValue() );
 }
 
-void writeLine( const vector<uint8_t>& p, VideoFrame& out, unsigned y, int dx ){
-	auto row2 = out.scanline( y );
+static const double alignment_scale = 5;
+
+///Shift of odd line iy+1 from the even lines around it. top holds line iy
+///and is replaced with line iy+2
+template<typename Sample>
+static int lineShift( VideoFrame& frame, vector<Sample>& top, unsigned iy, unsigned end, unsigned decimate ){
+	int range = max( 1, int( 2*alignment_scale ) / int(decimate) ); //Same distance at any resolution
+	auto bottom = searchLine<Sample>( frame, iy+2, alignment_scale, decimate );
+	auto middle = searchLine<Sample>( frame, iy+1, alignment_scale, decimate );
 	
-	for( unsigned ix=0; ix<out.width(); ix++ ){
-		unsigned pos = unsigned(ix+dx+p.size()) % p.size();
-		row2[ix] = p[pos];
-	}
-}
-void swapLine( const VideoFrame& p, VideoFrame& out, unsigned y, unsigned y_out ){
-	auto row1 = p.constScanline( y );
-	auto row2 = out.scanline( y_out );
+//	unsigned base = diffLines( middle, top, 0 ); // 1  0
 	
-	for( unsigned ix=0; ix<p.width(); ix++ )
-		row2[ix] = row1[ix];
+	int best_x = bestDiff( top, middle, range ); // 0  1
+	int best_x2 = bestDiff( bottom, middle, range ); // 2  1
+	if( iy == 0 )
+		best_x = best_x2;
+	if( iy == end-2 )
+		best_x2 = best_x;
+	top.swap( bottom );
+	
+//	cout << "Best dx (" << iy << "): " << best_x << " - " << best_x2 << endl;
+	
+	INSTRUMENT_COUNT( LINES, 1 );
+	INSTRUMENT_SHIFT( (best_x+best_x2)/2 * int(decimate) );
+	return (best_x+best_x2)/2 * int(decimate);
 }
 
-DumpPlane& blurFrames( DumpPlane& p ){
-	for( unsigned iy=0; iy<p.getHeight(); iy+=2 ){
-		auto row1 = p.scanline( iy );
-		auto row2 = p.scanline( iy+1 );
-		for( unsigned ix=0; ix<p.getWidth(); ix++ ){
-			auto mid = (row1[ix] + row2[ix]) / 2;
-			row1[ix] = row2[ix] = mid;
-		}
-	}
+///Shift and scale back down in one pass, from a copy of the line
+template<typename Sample>
+static void shiftRow( VideoFrame& frame, unsigned y, int shift, vector<Sample>& source ){
+	auto row = reinterpret_cast<Sample*>( frame.scanline( y ) );
+	source.assign( row, row + frame.width() );
+	shiftLine( BasicVideoLine<Sample>( source ), alignment_scale, shift, row, frame.maxValue() );
+	//moveLine( p, out, iy+1, (best_x+best_x2)/2 );
+}
+
+template<typename Sample>
+void VideoFrame::analyseAlignment( vector<int>& shifts, unsigned decimate ){
+	unsigned end = height() - head_switch;
+	auto top = searchLine<Sample>( *this, 0, alignment_scale, decimate );
+	shifts.clear();
 	
-	return p;
+	//TODO: upscale 10x
+	for( unsigned iy=0; iy<end; iy+=2 )
+		shifts.push_back( lineShift( *this, top, iy, end, decimate ) );
 }
 
+template<typename Sample>
+void VideoFrame::applyAlignment( const vector<int>& shifts ){
+	vector<Sample> source;
+	for( unsigned i=0; i<shifts.size(); i++ )
+		shiftRow( *this, i*2+1, shifts[i], source );
+}
 
-void VideoFrame::initFrame( ffmpeg::Frame& newFrame ){
-	//Copy luma
-	auto luma_out = getPlane( 0 );
-	auto luma_in = newFrame.getPlane( 0 );
-	for( unsigned iy=0; iy<luma_in.size(); iy++ ){
-		auto in = luma_in[iy];
-		auto out_l = luma_out[iy];
-		
-		for( unsigned ix=0; ix<in.size(); ix++ )
-			out_l[ix] = in[ix];
-	}
-	
-	//Blend the halved chroma to quartered chroma
-	for( int plane=1; plane<=2; plane++ ){
-		auto in_plane = newFrame.getPlane( plane );
-		auto out_plane = getPlane( plane );
-		
-		for( unsigned iy=0; iy<in_plane.size(); iy += 2 ){
-			auto in = in_plane[iy], in2 = in_plane[iy+1];
-			auto out = out_plane[iy/2];
-			for( unsigned ix=0; ix<out.size(); ix++ )
-				out[ix] = (in[ix] + in2[ix]) / 2;
-		}
-	}
+///Lines per band, so that band of the frame, the source and the buffers
+///of the other stages stay in the L2 cache
+static unsigned bandLines( unsigned row_bytes ){
+	const unsigned cache_budget = 128 * 1024;
+	unsigned lines = cache_budget / (row_bytes * 5);
+	return max( 4u, min( 64u, lines ) ) & ~1u;
 }
 
-void VideoFrame::process(){
-//	separateFrames();
-	fixFrameAlignment();
-	fixBottom();
-	//fixInterlazing(); //Not yet valid solution
+void VideoFrame::processBands( ffmpeg::Frame& source, const function<void(unsigned,unsigned)>& input, FrameCorrection* correction ){
+	if( getDepth() > 8 )
+		processBandsImpl<uint16_t>( source, input, correction );
+	else
+		processBandsImpl<uint8_t>( source, input, correction );
 }
 
-void VideoFrame::fixFrameAlignment(){
-	double scale_factor = 5;
-	auto top = scaleLine( *this, 0, scale_factor );
-	auto bottom = top;
+template<typename Sample>
+void VideoFrame::processBandsImpl( ffmpeg::Frame& source, const function<void(unsigned,unsigned)>& input, FrameCorrection* correction ){
+	bool convert = !canTakeOver( source );
+	if( !convert )
+		takeFrom( source );
 	
-	//TODO: upscale 10x
-	for( unsigned iy=0; iy<576-8; iy+=2 ){
-		//Prepare new lines
-		top = bottom;
-		bottom = scaleLine( *this, iy+2, scale_factor );
-		auto middle = scaleLine( *this, iy+1, scale_factor );
-		
-	//	unsigned base = diffLines( middle, top, 0 ); // 1  0
-		
-		int best_x = bestDiff( top, middle, 2*scale_factor ); // 0  1
-		int best_x2 = bestDiff( bottom, middle, 2*scale_factor ); // 2  1
-		if( iy == 0 )
-			best_x = best_x2;
-		if( iy == 576-8-2 )
-			best_x2 = best_x;
-		
-	//	cout << "Best dx (" << iy << "): " << best_x << " - " << best_x2 << endl;
+	unsigned band = bandLines( rowBytes() );
+	unsigned end = height() - head_switch;
+	unsigned next_pair = 0;
+	vector<Sample> top, row_copy;
+	FrameCorrection applied;
+	for( unsigned first=0; first<height(); first+=band ){
+		unsigned last = min( first + band, height() );
+		if( convert ){
+			INSTRUMENT_SCOPE( INIT );
+			convertLines( source, first, last );
+		}
+		if( input )
+			input( first, last );
 		
-		auto middleCopy = middle;
-		moveLine( middleCopy, middle, (best_x+best_x2)/2 );
-		auto output = scaleLineDown( middle, scale_factor );
-		writeLine( output, *this, iy+1, 0 );
-		//moveLine( p, out, iy+1, (best_x+best_x2)/2 );
-		//TODO: downscale again
+		//Every line pair which has all three lines converted
+		INSTRUMENT_SCOPE( ALIGNMENT );
+		for( ; next_pair < end && next_pair+2 < last; next_pair+=2 ){
+			if( next_pair == 0 )
+				top = searchLine<Sample>( *this, 0, alignment_scale, 1 );
+			applied.shifts.push_back( lineShift( *this, top, next_pair, end, 1 ) );
+			shiftRow( *this, next_pair+1, applied.shifts.back(), row_copy );
+		}
 	}
+	
+	//The head switching band is the last one, so it is still in cache
+	INSTRUMENT_SCOPE( BOTTOM );
+	analyseBottom<Sample>( applied, 1 );
+	applyBottom<Sample>( applied );
+	if( correction )
+		*correction = move( applied );
 }
-void VideoFrame::fixBottom(){
+
+template<typename Sample>
+void VideoFrame::analyseBottom( FrameCorrection& correction, unsigned decimate ){
 	//* Lines in bottom fix
-	VideoLine base( *this, 576-8-2 );
-	for( unsigned iy=576-8; iy<height(); iy++ ){
+	unsigned start = height() - head_switch;
+	auto base_line = searchLine<Sample>( *this, start-2, decimate );
+	BasicVideoLine<Sample> base( base_line );
+	correction.bottom_shifts.clear();
+	correction.bottom_scales.clear();
+	
+	vector<Sample> line, scaled;
+	for( unsigned iy=start; iy<height(); iy++ ){
 		double best_scale = 1.0;
 		int best_x = 0;
 		unsigned best_val = -1;
 		
+		line = searchLine<Sample>( *this, iy, decimate );
 		for( double iz = 1.000; iz<1.03; iz += 0.001 ){
-			scaleLineEx( *this, iy, iz, scaled );
-			if( bestDiffEx( base, scaled, best_x, best_val, 200 ) )
+			scaleLineEx( BasicVideoLine<Sample>( line ), iz, scaled, maxValue() );
+			if( bestDiffEx( base, BasicVideoLine<Sample>( scaled ), best_x, best_val, 200 / decimate ) )
 				best_scale = iz;
 		}
-		scaleLineEx( *this, iy, best_scale, scaled );
-		writeLine( scaled, *this, iy, best_x );
+		INSTRUMENT_COUNT( LINES, 1 );
+		INSTRUMENT_BOTTOM( best_x * int(decimate), best_scale );
+		
+		correction.bottom_shifts.push_back( best_x * int(decimate) );
+		correction.bottom_scales.push_back( best_scale );
 	//	cout << "scale: " << best_scale << endl;
 	//	cout << "best_x: " << best_x << endl;
 	}
 }
 
-void VideoFrame::fixInterlazing(){
-	//For now, just blur them together, essentially reducing the resolution...
-	for( unsigned iy=0; iy<576-8; iy+=2 ){
-		VideoLine top( *this, iy ), bottom( *this, iy+1 );
-		for( unsigned ix=0; ix<720; ix++ )
-			top[ix] = bottom[ix] = (top[ix] + bottom[ix]) / 2;
+template<typename Sample>
+void VideoFrame::applyBottom( const FrameCorrection& correction ){
+	unsigned start = height() - head_switch;
+	vector<Sample> scaled;
+	for( unsigned i=0; i<correction.bottom_shifts.size(); i++ ){
+		scaleLineEx( *this, start+i, correction.bottom_scales[i], scaled, maxValue() );
+		writeLine( scaled, *this, start+i, correction.bottom_shifts[i] );
 	}
 }
 
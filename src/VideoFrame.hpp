@@ -20,26 +20,74 @@
 
 #include "ffmpeg.hpp"
 
+#include <functional>
 #include <stdint.h>
 #include <vector>
 
+///Corrections found by VideoFrame::analyse(), in full resolution units
+struct FrameCorrection{
+	std::vector<int> shifts;          ///Each odd line above the head switching, in 1/5 pixels
+	std::vector<int> bottom_shifts;   ///Each line of the head switching band
+	std::vector<double> bottom_scales;
+	
+	///Linear blend, t of 0 gives a and 1 gives b
+	static FrameCorrection interpolate( const FrameCorrection& a, const FrameCorrection& b, double t );
+};
+
+/* Sources above 8 bit are processed as 10 bit in 16 bit samples. The public
+ * functions dispatch on the depth to the templated implementations. */
 class VideoFrame : public ffmpeg::Frame{
 	private:
-		std::vector<uint8_t> scaled;
+		unsigned head_switch; ///Lines at the bottom disturbed by the head switching
+		
+		bool canTakeOver( ffmpeg::Frame& newFrame );
+		///Converts lines [first,last) of newFrame to the working format, both even
+		void convertLines( ffmpeg::Frame& newFrame, unsigned first, unsigned last );
+		void initHighDepth( ffmpeg::Frame& newFrame, unsigned first, unsigned last );
+		template<typename Sample> void processBandsImpl( ffmpeg::Frame& source, const std::function<void(unsigned,unsigned)>& input, FrameCorrection* correction );
+		template<typename Sample> void analyseAlignment( std::vector<int>& shifts, unsigned decimate );
+		template<typename Sample> void applyAlignment( const std::vector<int>& shifts );
+		template<typename Sample> void analyseBottom( FrameCorrection& correction, unsigned decimate );
+		template<typename Sample> void applyBottom( const FrameCorrection& correction );
 		
 	public:
-		VideoFrame() : ffmpeg::Frame( 720, 576 ) { }
+		///head_switch of 0 estimates it from the height
+		VideoFrame( unsigned width, unsigned height, unsigned head_switch=0, unsigned depth=8 );
+		
+		///Format the frames are processed in, for a source of this depth
+		static AVPixelFormat formatFor( unsigned depth ){
+			return depth > 8 ? AV_PIX_FMT_YUV420P10 : AV_PIX_FMT_YUV420P;
+		}
+		
+		///If convertLines() can read this format: 4:2:0 or 4:2:2 in native
+		///endianness, with the chroma in separate planes or interleaved
+		static bool canConvert( AVPixelFormat format );
+		
+		unsigned headSwitchLines() const{ return head_switch; }
+		///Bytes of one row of luma
+		unsigned rowBytes() const{ return width() * (getDepth() > 8 ? 2 : 1); }
 		
 		void initFrame( ffmpeg::Frame& newFrame );
 		void process();
 		
+		///process() split in searching and applying the corrections.
+		///decimate of 2 searches on half the horizontal resolution
+		void analyse( FrameCorrection& correction, unsigned decimate=1 );
+		void apply( const FrameCorrection& correction );
+		
+		///initFrame() and process() fused, going through the frame in bands of
+		///lines small enough to stay in cache between the stages. input is
+		///given each band once converted, before any line in it is changed.
+		///correction, if given, is set to the corrections that were applied
+		void processBands( ffmpeg::Frame& source, const std::function<void(unsigned,unsigned)>& input, FrameCorrection* correction=nullptr );
+		
 		void fixFrameAlignment();
 		void fixBottom();
-		void fixInterlazing();
 		
 		void separateFrames();
 		
-		uint8_t getDepth() const{ return 8; }
+		uint8_t getDepth() const{ return depth(); }
+		unsigned maxValue() const{ return (1u << getDepth()) - 1; }
 };
 
 #endif
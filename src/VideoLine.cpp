@@ -0,0 +1,571 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "VideoLine.hpp"
+#include "Instrument.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+using namespace std;
+
+double cubic( double b, double c, double x ){
+	x = abs( x );
+	
+	if( x < 1 )
+		return
+				(12 - 9*b - 6*c)/6 * x*x*x
+			+	(-18 + 12*b + 6*c)/6 * x*x
+			+	(6 - 2*b)/6
+			;
+	else if( x < 2 )
+		return
+				(-b - 6*c)/6 * x*x*x
+			+	(6*b + 30*c)/6 * x*x
+			+	(-12*b - 48*c)/6 * x
+			+	(8*b + 24*c)/6
+			;
+	else
+		return 0;
+}
+
+double scale_func( double x ){
+	return cubic( 1.0/3, 1.0/3, x );
+}
+
+
+namespace{
+	///Precalculated filter weights for every output pixel of a resize
+	struct Taps{
+		vector<unsigned> left;
+		vector<unsigned> offset; //Into weights, one extra entry at the end
+		vector<double> weights;
+		vector<double> amount;
+		unsigned last{ 0 }; ///Last source pixel, taps past it repeat it
+		
+		unsigned size() const{ return left.size(); }
+	};
+	
+	typedef map<pair<uint32_t,double>, Taps> TapCache;
+	
+	//The weights are calculated exactly as in the reference versions,
+	//so the results are bit identical
+	const Taps& upscaleTaps( uint32_t in_width, double x_scale ){
+		thread_local TapCache cache;
+		auto& taps = cache[ make_pair( in_width, x_scale ) ];
+		if( !taps.offset.empty() )
+			return taps;
+		
+		unsigned width = unsigned(in_width * x_scale);
+		taps.last = in_width - 1;
+		taps.offset.push_back( 0 );
+		for( unsigned ix=0; ix<width; ix++ ){
+			double pos = ix * (in_width-1) / ((in_width-1) * x_scale);
+			int left = floor( pos - 2 );
+			unsigned right = ceil( pos + 2 );
+			
+			left = max( left, 0 );
+			right = min( right, in_width );
+			
+			double amount = 0.0;
+			for( unsigned jx=left; jx<=right; jx++ ){
+				double w = scale_func( jx - pos );
+				taps.weights.push_back( w );
+				amount += w;
+			}
+			taps.left.push_back( left );
+			taps.amount.push_back( amount );
+			taps.offset.push_back( taps.weights.size() );
+		}
+		
+		return taps;
+	}
+	
+	const Taps& downscaleTaps( uint32_t in_width, double x_scale ){
+		thread_local TapCache cache;
+		auto& taps = cache[ make_pair( in_width, x_scale ) ];
+		if( !taps.offset.empty() )
+			return taps;
+		
+		x_scale = 1.0 / x_scale;
+		unsigned width = unsigned(in_width * x_scale);
+		taps.last = in_width - 1;
+		taps.offset.push_back( 0 );
+		for( unsigned ix=0; ix<width; ix++ ){
+			unsigned left_big = max( ix, 2u ) - 2;
+			unsigned right_big = min( ix+2, in_width-1 );
+			
+			unsigned left = left_big * (in_width-1) / (width-1);
+			unsigned right = right_big * (in_width-1) / (width-1);
+			double center = ix * (in_width-1.0) / (width-1.0);
+			
+			double amount = 0.0;
+			for( unsigned jx=left; jx<=right; jx++ ){
+				double w = scale_func( (jx - center)*x_scale );
+				taps.weights.push_back( w );
+				amount += w;
+			}
+			taps.left.push_back( left );
+			taps.amount.push_back( amount );
+			taps.offset.push_back( taps.weights.size() );
+		}
+		
+		return taps;
+	}
+	
+	///Within 0 and the largest value of the depth, which may be less than
+	///the one of the type
+	template<typename Sample>
+	Sample clampSample( double value, unsigned max_value ){
+		return max( 0.0, min( double(max_value), value ) );
+	}
+	
+	template<typename Sample>
+	void applyTaps( const Taps& taps, const BasicVideoLine<Sample>& p, Sample* out, unsigned max_value ){
+		for( unsigned ix=0; ix<taps.size(); ix++ ){
+			auto in = p.begin() + taps.left[ix];
+			auto w = taps.weights.data() + taps.offset[ix];
+			unsigned count = taps.offset[ix+1] - taps.offset[ix];
+			unsigned inside = min( count, taps.last + 1 - taps.left[ix] );
+			
+			double sum = 0.0;
+			unsigned jx=0;
+			for( ; jx<inside; jx++ )
+				sum += w[jx] * in[jx];
+			for( ; jx<count; jx++ )
+				sum += w[jx] * in[inside-1];
+			out[ix] = clampSample<Sample>( sum / taps.amount[ix], max_value );
+		}
+	}
+	
+	///Weights from the source line straight to the output of upscaling,
+	///rotating by dx and downscaling again. Unlike Taps the source indices
+	///are stored, as the rotation wraps around at the edges
+	struct FusedTaps{
+		vector<unsigned> offset; //Into index and weights, one extra entry at the end
+		vector<unsigned> index;
+		vector<double> weights;
+		
+		unsigned size() const{ return offset.size() - 1; }
+	};
+	
+	const FusedTaps& fusedTaps( uint32_t in_width, double x_scale, int dx ){
+		thread_local map<tuple<uint32_t,double,int>, FusedTaps> cache;
+		auto& taps = cache[ make_tuple( in_width, x_scale, dx ) ];
+		if( !taps.offset.empty() )
+			return taps;
+		
+		auto& up = upscaleTaps( in_width, x_scale );
+		auto& down = downscaleTaps( up.size(), x_scale );
+		taps.offset.push_back( 0 );
+		for( unsigned ix=0; ix<down.size(); ix++ ){
+			map<unsigned,double> weights;
+			for( unsigned jx=down.offset[ix]; jx<down.offset[ix+1]; jx++ ){
+				//The last taps of the downscaler are past the end, which is clamped too
+				unsigned moved = min( down.left[ix] + (jx - down.offset[ix]), up.size()-1 );
+				unsigned u = ( moved + dx + up.size() ) % up.size();
+				double w = down.weights[jx] / down.amount[ix] / up.amount[u];
+				for( unsigned kx=up.offset[u]; kx<up.offset[u+1]; kx++ ){
+					//The upscaler repeats the last pixel past the end
+					unsigned source = min( up.left[u] + (kx - up.offset[u]), in_width-1 );
+					weights[source] += w * up.weights[kx];
+				}
+			}
+			
+			for( auto& weight : weights ){
+				taps.index.push_back( weight.first );
+				taps.weights.push_back( weight.second );
+			}
+			taps.offset.push_back( taps.index.size() );
+		}
+		
+		return taps;
+	}
+	
+	///Copies a line rotated by dx, in at most a few contiguous runs
+	template<typename Sample>
+	void rotateCopy( const Sample* in, unsigned in_width, Sample* out, unsigned out_width, int dx ){
+		unsigned pos = unsigned(dx + int(in_width)) % in_width;
+		for( unsigned ix=0; ix<out_width; ){
+			unsigned run = min( out_width - ix, in_width - pos );
+			copy( in + pos, in + pos + run, out + ix );
+			ix += run;
+			pos = 0;
+		}
+	}
+	
+	///Sum of absolute differences in vectors of 16 samples of either width,
+	///widened so they can't overflow. GCC vector extensions, so it needs no
+	///target specific flags
+	template<typename Sample>
+	unsigned sadVector( const Sample* p1, const Sample* p2, unsigned width ){
+		const unsigned lanes = 16;
+		typedef int32_t SumVector __attribute__(( vector_size( lanes * 4 ) ));
+		typedef Sample Vector __attribute__(( vector_size( lanes * sizeof(Sample) ) ));
+		
+		SumVector sums = {};
+		unsigned ix = 0;
+		for( ; ix+lanes<=width; ix+=lanes ){
+			Vector v1, v2;
+			memcpy( &v1, p1 + ix, sizeof(v1) );
+			memcpy( &v2, p2 + ix, sizeof(v2) );
+			SumVector diff = __builtin_convertvector( v1, SumVector ) - __builtin_convertvector( v2, SumVector );
+			SumVector sign = diff >> 31;
+			sums += (diff ^ sign) - sign;
+		}
+		
+		unsigned sum = 0;
+		for( unsigned i=0; i<lanes; i++ )
+			sum += sums[i];
+		for( ; ix<width; ix++ )
+			sum += abs( (int)p1[ix] - (int)p2[ix] );
+		return sum;
+	}
+	
+	///diffLines for two lines of a width known at compile time, so the runs
+	///have fixed bounds and only the one at the wrap-around has a tail
+	template<typename Sample, unsigned Width>
+	unsigned diffFixed( const Sample* p1, const Sample* p2, int dx ){
+		unsigned pos = unsigned(dx + int(Width)) % Width;
+		return sadVector( p1, p2 + pos, Width-pos ) + sadVector( p1 + Width-pos, p2, pos );
+	}
+	
+	template<typename Sample, unsigned (*diff)( const BasicVideoLine<Sample>&, const BasicVideoLine<Sample>&, int )>
+	pair<unsigned,int> recursiveDiffImpl( const BasicVideoLine<Sample>& p1, const BasicVideoLine<Sample>& p2, int left, int right ){
+		if( right - left <= 1 )
+			return make_pair( diff( p1, p2, left ), left );
+		else{
+		//	cout << "In: " << left << " - " << right << endl;
+			auto middle = (right - left) / 2 + left;
+			auto newLeft = (middle - left) / 2 + left;
+			auto newRight = (right - middle) / 2 + middle;
+		
+		//	cout << "Out: " << newLeft << " - " << newRight << endl;
+			auto leftVal  = diff( p1, p2, newLeft );
+			auto rightVal = diff( p1, p2, newRight );
+			
+			if( leftVal < rightVal )
+				return recursiveDiffImpl<Sample, diff>( p1, p2, left, middle );
+			else
+				return recursiveDiffImpl<Sample, diff>( p1, p2, middle, right );
+		}
+	}
+}
+
+
+template<typename Sample>
+void scaleLineEx( const BasicVideoLine<Sample>& p, double x_scale, vector<Sample>& data, unsigned max_value ){
+	auto& taps = upscaleTaps( p.getWidth(), x_scale );
+	data.resize( taps.size() );
+	applyTaps( taps, p, data.data(), max_value );
+}
+
+template<typename Sample>
+vector<Sample> scaleLine( const BasicVideoLine<Sample>& p, double x_scale, unsigned max_value ){
+	vector<Sample> data;
+	scaleLineEx( p, x_scale, data, max_value );
+	return data;
+}
+
+template<typename Sample>
+vector<Sample> scaleLine( ffmpeg::Frame& frame, unsigned y, double x_scale, unsigned max_value ){
+	BasicVideoLine<Sample> p( frame, y );
+	return scaleLine( p, x_scale, max_value );
+}
+
+template<typename Sample>
+void scaleLineEx( ffmpeg::Frame& frame, unsigned y, double x_scale, vector<Sample>& data, unsigned max_value ){
+	BasicVideoLine<Sample> p( frame, y );
+	scaleLineEx( p, x_scale, data, max_value );
+}
+
+
+template<typename Sample>
+vector<Sample> scaleLineDown( const BasicVideoLine<Sample>& p, double x_scale, unsigned max_value ){
+	auto& taps = downscaleTaps( p.getWidth(), x_scale );
+	vector<Sample> data( taps.size(), 0 );
+	applyTaps( taps, p, data.data(), max_value );
+	return data;
+}
+
+template<typename Sample>
+vector<Sample> scaleLineDown( vector<Sample>& p, double x_scale, unsigned max_value ){
+	BasicVideoLine<Sample> line( p );
+	return scaleLineDown( line, x_scale, max_value );
+}
+
+template<typename Sample>
+unsigned sadRow( const Sample* p1, const Sample* p2, unsigned width ){
+	return sadVector( p1, p2, width );
+}
+
+template<typename Sample>
+unsigned diffLines( const BasicVideoLine<Sample>& p1, const BasicVideoLine<Sample>& p2, int dx ){
+	INSTRUMENT_COUNT( SAD_EVALS, 1 );
+	
+	//Rec. 601 and 4fsc NTSC/PAL active lines, and the 5x upscaled ones
+	//compared in fixFrameAlignment
+	if( p1.getWidth() == p2.getWidth() )
+		switch( p1.getWidth() ){
+			case  720: return diffFixed<Sample,  720>( p1.begin(), p2.begin(), dx );
+			case  768: return diffFixed<Sample,  768>( p1.begin(), p2.begin(), dx );
+			case  948: return diffFixed<Sample,  948>( p1.begin(), p2.begin(), dx );
+			case 3600: return diffFixed<Sample, 3600>( p1.begin(), p2.begin(), dx );
+			case 3840: return diffFixed<Sample, 3840>( p1.begin(), p2.begin(), dx );
+			case 4740: return diffFixed<Sample, 4740>( p1.begin(), p2.begin(), dx );
+		}
+	
+	//Split the wrap-around into contiguous runs, instead of a modulo per pixel
+	unsigned width2 = p2.getWidth();
+	unsigned pos = unsigned(dx + int(width2)) % width2;
+	unsigned sum = 0;
+	for( unsigned ix=0; ix<p1.getWidth(); ){
+		unsigned run = min( p1.getWidth() - ix, width2 - pos );
+		sum += sadRow( p1.begin() + ix, p2.begin() + pos, run );
+		ix += run;
+		pos = 0;
+	}
+	
+	return sum;
+}
+
+template<typename Sample>
+pair<unsigned,int> recursiveDiff( const BasicVideoLine<Sample>& p1, const BasicVideoLine<Sample>& p2, int left, int right ){
+	return recursiveDiffImpl<Sample, diffLines<Sample>>( p1, p2, left, right );
+}
+
+/*
+bool bestDiffEx( const VideoLine& p1, const VideoLine& p2, int& best_x2, unsigned& best_val, int amount ){
+	bool improved = false;
+
+	unsigned best = -1;
+	int best_x = -1;
+	for( int dx=-amount; dx<=amount; dx++ ){
+		auto current = diffLines( p1, p2, dx );
+		if( current < best ){
+			best = current;
+			best_x = dx;
+		}
+	}
+
+	if( best < best_val ){
+		improved = true;
+		best_val = best;
+		best_x2 = best_x;
+	}
+	return improved;
+}
+/*/
+template<typename Sample>
+bool bestDiffEx( const BasicVideoLine<Sample>& p1, const BasicVideoLine<Sample>& p2, int& best_x2, unsigned& best_val, int amount ){
+	auto result = recursiveDiff( p1, p2, -amount, amount );
+	if( result.first < best_val ){
+		best_x2 = result.second;
+		best_val = result.first;
+		return true;
+	}
+	return false;
+}
+//*/
+
+template<typename Sample>
+int bestDiff( vector<Sample>& line1, vector<Sample>& line2, int amount ){
+	BasicVideoLine<Sample> l1( line1 ), l2( line2 );
+	
+	unsigned best_val = -1;
+	int best_x = 0;
+	bestDiffEx( l1, l2, best_x, best_val, amount );
+	return best_x;
+}
+
+template<typename Sample>
+void moveLine( BasicVideoLine<Sample>& p, BasicVideoLine<Sample>& out, int dx ){
+	rotateCopy( p.begin(), p.getWidth(), &out[0], out.getWidth(), dx );
+}
+
+template<typename Sample>
+void moveLine( vector<Sample>& p, vector<Sample>& out, int dx ){
+	BasicVideoLine<Sample> p1( p ), out1( out );
+	moveLine( p1, out1, dx );
+}
+
+template<typename Sample>
+void writeLine( const vector<Sample>& p, ffmpeg::Frame& out, unsigned y, int dx ){
+	rotateCopy( p.data(), p.size(), reinterpret_cast<Sample*>( out.scanline( y ) ), out.width(), dx );
+}
+
+template<typename Sample>
+void shiftLine( const BasicVideoLine<Sample>& p, double x_scale, int dx, Sample* out, unsigned max_value ){
+	auto& taps = fusedTaps( p.getWidth(), x_scale, dx );
+	for( unsigned ix=0; ix<taps.size(); ix++ ){
+		double sum = 0.0;
+		for( unsigned jx=taps.offset[ix]; jx<taps.offset[ix+1]; jx++ )
+			sum += taps.weights[jx] * p[ taps.index[jx] ];
+		out[ix] = clampSample<Sample>( sum, max_value );
+	}
+}
+
+//Both sample sizes are compiled here, so the templates can stay out of the header
+#define INSTANTIATE_LINE_KERNELS( Sample ) \
+	template void scaleLineEx( const BasicVideoLine<Sample>&, double, vector<Sample>&, unsigned ); \
+	template void scaleLineEx( ffmpeg::Frame&, unsigned, double, vector<Sample>&, unsigned ); \
+	template vector<Sample> scaleLine( const BasicVideoLine<Sample>&, double, unsigned ); \
+	template vector<Sample> scaleLine<Sample>( ffmpeg::Frame&, unsigned, double, unsigned ); \
+	template vector<Sample> scaleLineDown( const BasicVideoLine<Sample>&, double, unsigned ); \
+	template vector<Sample> scaleLineDown( vector<Sample>&, double, unsigned ); \
+	template unsigned sadRow( const Sample*, const Sample*, unsigned ); \
+	template unsigned diffLines( const BasicVideoLine<Sample>&, const BasicVideoLine<Sample>&, int ); \
+	template pair<unsigned,int> recursiveDiff( const BasicVideoLine<Sample>&, const BasicVideoLine<Sample>&, int, int ); \
+	template bool bestDiffEx( const BasicVideoLine<Sample>&, const BasicVideoLine<Sample>&, int&, unsigned&, int ); \
+	template int bestDiff( vector<Sample>&, vector<Sample>&, int ); \
+	template void moveLine( BasicVideoLine<Sample>&, BasicVideoLine<Sample>&, int ); \
+	template void moveLine( vector<Sample>&, vector<Sample>&, int ); \
+	template void writeLine( const vector<Sample>&, ffmpeg::Frame&, unsigned, int ); \
+	template void shiftLine( const BasicVideoLine<Sample>&, double, int, Sample*, unsigned );
+
+INSTANTIATE_LINE_KERNELS( uint8_t )
+INSTANTIATE_LINE_KERNELS( uint16_t )
+
+
+void reference::scaleLineEx( const VideoLine& p, double x_scale, vector<uint8_t>& data ){
+	unsigned width = unsigned(p.getWidth() * x_scale);
+	data.resize( width );
+	
+	for( unsigned ix=0; ix<data.size(); ix++ ){
+		double pos = ix * (p.getWidth()-1) / ((p.getWidth()-1) * x_scale);
+		int left = floor( pos - 2 );
+		unsigned right = ceil( pos + 2 );
+		
+		//Limit
+		left = max( left, 0 );
+		right = min( right, p.getWidth() );
+		
+		double sum = 0.0;
+		double amount = 0.0;
+		for( unsigned jx=left; jx<=right; jx++ ){
+			double w = scale_func( jx - pos );
+			sum += w * p[ min( jx, p.getWidth()-1 ) ];
+			amount += w;
+		}
+		data[ix] = max( 0.0, min( 255.0, sum / amount ) );
+	}
+}
+
+vector<uint8_t> reference::scaleLineDown( const VideoLine& p, double x_scale ){
+	x_scale = 1.0 / x_scale;
+	unsigned width = unsigned(p.getWidth() * x_scale);
+	vector<uint8_t> data( width, 0 ); //TODO: same as upscale
+	
+	for( unsigned ix=0; ix<data.size(); ix++ ){
+		unsigned left_big = max( ix, 2u ) - 2;
+		unsigned right_big = min( ix+2, p.getWidth()-1 );
+		
+		//Scale
+		unsigned left = left_big * (p.getWidth()-1) / (data.size()-1);
+		unsigned right = right_big * (p.getWidth()-1) / (data.size()-1);
+		double center = ix * (p.getWidth()-1.0) / (data.size()-1.0);
+		
+		double sum = 0.0;
+		double amount = 0.0;
+		for( unsigned jx=left; jx<=right; jx++ ){
+			double w = scale_func( (jx - center)*x_scale );
+			sum += w * p[ min( jx, p.getWidth()-1 ) ];
+			amount += w;
+		}
+		data[ix] = max( 0.0, min( 255.0, sum / amount ) );
+	}
+	
+	return data;
+}
+
+unsigned reference::diffLines( const VideoLine& p1, const VideoLine& p2, int dx ){
+	INSTRUMENT_COUNT( SAD_EVALS, 1 );
+	unsigned sum=0;
+	for( unsigned ix=0; ix<p1.getWidth(); ix++ ){
+		unsigned pos = unsigned(ix+dx+p2.getWidth()) % p2.getWidth();
+		auto error = abs( (int)p1[ix] - (int)p2[pos] );
+		sum += error;
+	}
+	
+	return sum;
+}
+
+pair<unsigned,int> reference::recursiveDiff( const VideoLine& p1, const VideoLine& p2, int left, int right ){
+	return recursiveDiffImpl<uint8_t, reference::diffLines>( p1, p2, left, right );
+}
+
+void reference::moveLine( VideoLine& p, VideoLine& out, int dx ){
+	for( unsigned ix=0; ix<out.getWidth(); ix++ ){
+		unsigned pos = unsigned(ix+dx+p.getWidth()) % p.getWidth();
+		out[ix] = p[pos];
+	}
+}
+
+void reference::writeLine( const vector<uint8_t>& p, ffmpeg::Frame& out, unsigned y, int dx ){
+	auto row2 = out.scanline( y );
+	
+	for( unsigned ix=0; ix<out.width(); ix++ ){
+		unsigned pos = unsigned(ix+dx+p.size()) % p.size();
+		row2[ix] = p[pos];
+	}
+}
+
+void reference::shiftLine( const VideoLine& p, double x_scale, int dx, uint8_t* out ){
+	//The unfused steps, without rounding in between
+	unsigned up_width = unsigned(p.getWidth() * x_scale);
+	vector<double> up( up_width );
+	for( unsigned ix=0; ix<up_width; ix++ ){
+		double pos = ix * (p.getWidth()-1) / ((p.getWidth()-1) * x_scale);
+		int left = max( int(floor( pos - 2 )), 0 );
+		unsigned right = min( unsigned(ceil( pos + 2 )), p.getWidth() );
+		
+		double sum = 0.0;
+		double amount = 0.0;
+		for( unsigned jx=left; jx<=right; jx++ ){
+			double w = scale_func( jx - pos );
+			sum += w * p[ min( jx, p.getWidth()-1 ) ];
+			amount += w;
+		}
+		up[ix] = sum / amount;
+	}
+	
+	vector<double> moved( up_width );
+	for( unsigned ix=0; ix<up_width; ix++ )
+		moved[ix] = up[ (ix + dx + up_width) % up_width ];
+	
+	unsigned width = unsigned(up_width / x_scale);
+	for( unsigned ix=0; ix<width; ix++ ){
+		unsigned left_big = max( ix, 2u ) - 2;
+		unsigned right_big = min( ix+2, up_width-1 );
+		unsigned left = left_big * (up_width-1) / (width-1);
+		unsigned right = right_big * (up_width-1) / (width-1);
+		double center = ix * (up_width-1.0) / (width-1.0);
+		
+		double sum = 0.0;
+		double amount = 0.0;
+		for( unsigned jx=left; jx<=right; jx++ ){
+			double w = scale_func( (jx - center) / x_scale );
+			sum += w * moved[ min( jx, up_width-1 ) ];
+			amount += w;
+		}
+		out[ix] = max( 0.0, min( 255.0, sum / amount ) );
+	}
+}
@@ -0,0 +1,110 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VIDEO_LINE_HPP
+#define VIDEO_LINE_HPP
+
+#include "ffmpeg.hpp"
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+template<typename Sample>
+class BasicVideoLine{
+	private:
+		Sample* data;
+		uint32_t width;
+		
+	public:
+		BasicVideoLine( ffmpeg::Frame& frame, unsigned y ){
+			data = reinterpret_cast<Sample*>( frame.scanline( y ) );
+			width = frame.width();
+		}
+		
+		BasicVideoLine( std::vector<Sample>& buffer ){
+			data = buffer.data();
+			width = buffer.size();
+		}
+		
+		BasicVideoLine( Sample* data, uint32_t width ) : data(data), width(width) { }
+		
+		uint32_t getWidth() const{ return width; }
+		const Sample* begin() const{ return data; }
+		
+		Sample& operator[]( unsigned x ){ return data[x]; }
+		const Sample& operator[]( unsigned x ) const{ return data[x]; }
+};
+
+typedef BasicVideoLine<uint8_t> VideoLine;
+typedef BasicVideoLine<uint16_t> VideoLine16; ///For sources above 8 bit
+
+/* Line kernels used by VideoFrame, for 8 and 16 bit samples. The functions in
+ * the global namespace are the optimized ones, while the 8 bit originals are
+ * kept in "reference" so the regression mode can check that both produce
+ * the same output. The scalers clamp to max_value, the largest value of the
+ * depth, as a 10 bit source is held in 16 bit samples. */
+
+template<typename Sample>
+void scaleLineEx( const BasicVideoLine<Sample>& p, double x_scale, std::vector<Sample>& data, unsigned max_value );
+template<typename Sample>
+void scaleLineEx( ffmpeg::Frame& frame, unsigned y, double x_scale, std::vector<Sample>& data, unsigned max_value );
+template<typename Sample>
+std::vector<Sample> scaleLine( const BasicVideoLine<Sample>& p, double x_scale, unsigned max_value );
+template<typename Sample=uint8_t>
+std::vector<Sample> scaleLine( ffmpeg::Frame& frame, unsigned y, double x_scale, unsigned max_value );
+
+template<typename Sample>
+std::vector<Sample> scaleLineDown( const BasicVideoLine<Sample>& p, double x_scale, unsigned max_value );
+template<typename Sample>
+std::vector<Sample> scaleLineDown( std::vector<Sample>& p, double x_scale, unsigned max_value );
+
+///Sum of absolute differences of two contiguous runs of pixels
+template<typename Sample>
+unsigned sadRow( const Sample* p1, const Sample* p2, unsigned width );
+template<typename Sample>
+unsigned diffLines( const BasicVideoLine<Sample>& p1, const BasicVideoLine<Sample>& p2, int dx );
+template<typename Sample>
+std::pair<unsigned,int> recursiveDiff( const BasicVideoLine<Sample>& p1, const BasicVideoLine<Sample>& p2, int left, int right );
+template<typename Sample>
+bool bestDiffEx( const BasicVideoLine<Sample>& p1, const BasicVideoLine<Sample>& p2, int& best_x2, unsigned& best_val, int amount=10 );
+template<typename Sample>
+int bestDiff( std::vector<Sample>& line1, std::vector<Sample>& line2, int amount );
+
+template<typename Sample>
+void moveLine( BasicVideoLine<Sample>& p, BasicVideoLine<Sample>& out, int dx );
+template<typename Sample>
+void moveLine( std::vector<Sample>& p, std::vector<Sample>& out, int dx );
+template<typename Sample>
+void writeLine( const std::vector<Sample>& p, ffmpeg::Frame& out, unsigned y, int dx );
+
+///Upscales by x_scale, rotates by dx upscaled pixels and scales back down,
+///in one pass with precomputed taps. out must not overlap p
+template<typename Sample>
+void shiftLine( const BasicVideoLine<Sample>& p, double x_scale, int dx, Sample* out, unsigned max_value );
+
+namespace reference{
+	void scaleLineEx( const VideoLine& p, double x_scale, std::vector<uint8_t>& data );
+	std::vector<uint8_t> scaleLineDown( const VideoLine& p, double x_scale );
+	unsigned diffLines( const VideoLine& p1, const VideoLine& p2, int dx );
+	std::pair<unsigned,int> recursiveDiff( const VideoLine& p1, const VideoLine& p2, int left, int right );
+	void moveLine( VideoLine& p, VideoLine& out, int dx );
+	void writeLine( const std::vector<uint8_t>& p, ffmpeg::Frame& out, unsigned y, int dx );
+	void shiftLine( const VideoLine& p, double x_scale, int dx, uint8_t* out );
+}
+
+#endif
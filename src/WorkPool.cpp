@@ -0,0 +1,110 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "WorkPool.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+thread_local int WorkPool::current = -1;
+
+WorkPool::WorkPool( unsigned count ){
+	if( count == 0 )
+		count = max( 1u, thread::hardware_concurrency() );
+	
+	for( unsigned i=0; i<count; i++ )
+		workers.emplace_back( new Worker() );
+	for( unsigned i=0; i<count; i++ )
+		threads.emplace_back( [this,i](){ work( i ); } );
+}
+
+WorkPool::~WorkPool(){
+	{	lock_guard<mutex> guard( state_lock );
+		stopping = true;
+	}
+	wake.notify_all();
+	for( auto& t : threads )
+		t.join();
+}
+
+void WorkPool::submit( function<void()> task ){
+	unsigned index = current >= 0 ? current : next_worker++ % workers.size();
+	{	lock_guard<mutex> guard( workers[index]->lock );
+		workers[index]->tasks.push_back( move( task ) );
+	}
+	{	lock_guard<mutex> guard( state_lock );
+		queued++;
+		unfinished++;
+	}
+	wake.notify_one();
+}
+
+bool WorkPool::take( unsigned index, function<void()>& task ){
+	//Own tasks newest first
+	{	auto& own = *workers[index];
+		lock_guard<mutex> guard( own.lock );
+		if( !own.tasks.empty() ){
+			task = move( own.tasks.back() );
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+	
+	//Steal the oldest from the others
+	for( unsigned i=1; i<workers.size(); i++ ){
+		auto& other = *workers[ (index + i) % workers.size() ];
+		lock_guard<mutex> guard( other.lock );
+		if( !other.tasks.empty() ){
+			task = move( other.tasks.front() );
+			other.tasks.pop_front();
+			stolen++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkPool::work( unsigned index ){
+	current = index;
+	while( true ){
+		{	unique_lock<mutex> guard( state_lock );
+			wake.wait( guard, [this](){ return queued > 0 || stopping; } );
+			if( queued == 0 )
+				return;
+			queued--;
+		}
+		
+		//A task is reserved, so one of the queues has it
+		function<void()> task;
+		while( !take( index, task ) )
+			this_thread::yield();
+		task();
+		
+		bool done;
+		{	lock_guard<mutex> guard( state_lock );
+			done = --unfinished == 0;
+		}
+		if( done )
+			idle.notify_all();
+	}
+}
+
+void WorkPool::wait(){
+	unique_lock<mutex> guard( state_lock );
+	idle.wait( guard, [this](){ return unfinished == 0; } );
+}
@@ -0,0 +1,74 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORK_POOL_HPP
+#define WORK_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/* Thread pool where every worker has its own task queue. Tasks submitted
+ * from a worker go to its own queue and are run newest first, which keeps
+ * the data of a job in that worker's cache. Idle workers steal the oldest
+ * task of another worker. */
+class WorkPool{
+	private:
+		struct Worker{
+			std::mutex lock;
+			std::deque<std::function<void()>> tasks;
+		};
+		
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::vector<std::thread> threads;
+		
+		std::mutex state_lock;
+		std::condition_variable wake;    ///Tasks were added, or stopping
+		std::condition_variable idle;    ///Everything is done
+		unsigned queued{ 0 };            ///Guarded by state_lock
+		unsigned unfinished{ 0 };        ///Queued and running tasks
+		bool stopping{ false };
+		
+		std::atomic<unsigned> next_worker{ 0 };
+		std::atomic<uint64_t> stolen{ 0 };
+		
+		static thread_local int current; ///Worker index of this thread, -1 if none
+		
+		bool take( unsigned index, std::function<void()>& task );
+		void work( unsigned index );
+		
+	public:
+		///threads of 0 uses one per core
+		WorkPool( unsigned threads=0 );
+		~WorkPool();
+		
+		unsigned size() const{ return workers.size(); }
+		
+		void submit( std::function<void()> task );
+		///Blocks until all tasks are done, including the ones they submit
+		void wait();
+		
+		uint64_t steals() const{ return stolen; }
+};
+
+#endif
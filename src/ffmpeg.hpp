@@ -46,6 +46,8 @@ namespace ffmpeg{
 			uint32_t height() const{ return frame->height; }
 			
 			AVPixelFormat format() const{ return (AVPixelFormat)frame->format; }
+			///Bits per sample
+			unsigned depth() const{ return av_pix_fmt_desc_get( format() )->comp[0].depth_minus1 + 1; }
 			AVFrame* getFrame(){ return frame; }
 			
 		public:
@@ -62,14 +64,8 @@ namespace ffmpeg{
 					frame->height = height;
 					
 					//TODO: check, and throw on both errors
-					av_image_alloc(
-							frame->data
-						,	frame->linesize
-						,	frame->width
-						,	frame->height
-						,	format
-						,	32
-						);
+					//Reference counted, so the buffers can be swapped with decoded frames
+					av_frame_get_buffer( frame, 32 );
 				}
 			}
 			
@@ -80,6 +76,12 @@ namespace ffmpeg{
 			
 			//TODO: add move constructor
 			
+			///Takes over the buffers and properties of other, leaving it empty
+			void takeFrom( Frame& other ){
+				av_frame_unref( frame );
+				av_frame_move_ref( frame, other.frame );
+			}
+			
 			~Frame(){ av_frame_free( &frame ); }
 			
 			
@@ -18,46 +18,183 @@
 #include "ffmpeg.hpp"
 #include "VideoFrame.hpp"
 #include "VideoFile.hpp"
+#include "Checkpoint.hpp"
+#include "Instrument.hpp"
+#include "Batch.hpp"
+#include "ColourLut.hpp"
+#include "Arguments.hpp"
+#include "Daemon.hpp"
 
 #include <QCoreApplication>
 #include <QStringList>
 #include <QFile>
 
 #include <iostream>
+#include <memory>
+#include <vector>
 
 using namespace std;
 
 
 int showHelp( int return_code=0 ){
-	cout << "vhsfix filename unused" << endl;
+	cout << "vhsfix [options] input [encode options] output [[encode options] output2 ...]" << endl;
+	cout << "\tThe container is chosen by the output extension, audio is copied if it supports it" << endl;
+	cout << "\tEvery output is encoded from the same processed frames" << endl;
+	cout << "Encode options, applying to the next output:" << endl;
+	cout << "\t--codec name\t\tEncoder (default libx264)" << endl;
+	cout << "\t--preset name\t\tEncoder preset (default ultrafast)" << endl;
+	cout << "\t--crf value\t\tQuality (default 18)" << endl;
+	cout << "\t--size WxH\t\tResize before encoding" << endl;
+	cout << "Options:" << endl;
+	cout << "\t--start [[hh:]mm:]ss\tStart position" << endl;
+	cout << "\t--duration [[hh:]mm:]ss\tAmount of time to process" << endl;
+	cout << "\t--frames count\t\tAmount of frames to process" << endl;
+	cout << "\t--head-switch lines\tHeight of the head switching band (default from the height)" << endl;
+	cout << "\t--denoise frames\t\tAverage chroma over this many frames" << endl;
+	cout << "\t--denoise-threshold n\tChroma difference treated as motion (default 6)" << endl;
+	cout << "\t--stabilise [amount]\tRemove frame wobble, lower amounts follow motion slower (default 0.1)" << endl;
+	cout << "\t--deinterlace [threshold]\tBlend the fields where they differ by more than threshold (default 10)" << endl;
+	cout << "\t--lut file.cube\t\tGrade the colours with a 3D LUT" << endl;
+	cout << "\t--lift value\t\tGrade without a LUT, one value or \"r,g,b\" (default 0)" << endl;
+	cout << "\t--gamma value\t\t(default 1)" << endl;
+	cout << "\t--gain value\t\t(default 1)" << endl;
+	cout << "\t--preview [frames]\tQuick look: search every n frames (default 4) at half resolution, ultrafast encoding" << endl;
+	cout << "\t--checkpoint seconds\tSave progress this often so a crashed run can be resumed" << endl;
+	cout << "\t--resume\t\tContinue from the last checkpoint, same options as before (checkpoints every 10s)" << endl;
+	cout << "\t--max-memory MB\t\tMemory budget for frames in flight (default 64)" << endl;
+	cout << "\t--sync-io\t\tRead and write files on the processing threads" << endl;
+	cout << "\t--io-latency ms\t\tDelay every block read or written, to test slow storage" << endl;
+	cout << "\t--stats file.json\tWrite timing summary (requires CONFIG += instrument)" << endl;
+	cout << "vhsfix [options] [encode options] --batch list" << endl;
+	cout << "\tProcess every file in list on one thread pool, one \"input[<tab>output]\" per line" << endl;
+	cout << "\t--threads n\t\tWorker threads (default one per core)" << endl;
+	cout << "vhsfix [options] [encode options] [--threads n] --daemon socket" << endl;
+	cout << "\tKeep running and process the jobs sent to socket, options are the defaults of every job" << endl;
+	cout << "vhsfix --client socket [options] [encode options] input [output]" << endl;
+	cout << "\tQueue a job on the daemon and wait for it, output defaults to input.vhsfix.mkv" << endl;
+	cout << "vhsfix --client socket --status|--stop" << endl;
+	cout << "\tShow the queue, or stop once the queued jobs are done" << endl;
 	
 	return return_code;
 }
 
+void writeStats( QString path ){
+	if( path.isEmpty() )
+		return;
+#ifdef VHSFIX_INSTRUMENT
+	if( !instrument::writeSummary( path.toLocal8Bit().constData() ) )
+		cout << "Could not write stats file" << endl;
+#else
+	cout << "Built without instrumentation, no stats written" << endl;
+#endif
+}
+
 int main(int argc, char *argv[]){
 	av_register_all();
 	
 	QCoreApplication a(argc, argv);
 	auto args = a.arguments();
 	
-	if( args.size() < 3 )
-		return showHelp( -1 );
-	
-	VideoFile file( args[1] );
+	QString input;
+	vector<EncodeSettings> outputs;
+	EncodeSettings next_output;
+	QString stats_path;
+	QString batch_path;
+	QString daemon_path;
+	unsigned threads = 0;
+	Options options;
+	for( int i=1; i<args.size(); i++ ){
+		bool valid = true;
+		if( parseOption( args, i, options, next_output, &valid ) ){
+			if( !valid )
+				return showHelp( -1 );
+		}
+		else if( args[i] == "--stats" && i+1 < args.size() )
+			stats_path = args[++i];
+		else if( args[i] == "--batch" && i+1 < args.size() )
+			batch_path = args[++i];
+		else if( args[i] == "--threads" && i+1 < args.size() ){
+			threads = args[++i].toUInt( &valid );
+			if( !valid )
+				return showHelp( -1 );
+		}
+		else if( args[i] == "--daemon" && i+1 < args.size() )
+			daemon_path = args[++i];
+		else if( args[i] == "--client" && i+1 < args.size() )
+			return runClient( args[i+1], args.mid( i+2 ) );
+		else if( input.isEmpty() )
+			input = args[i];
+		else{
+			next_output.path = args[i];
+			outputs.push_back( next_output );
+			next_output = EncodeSettings();
+		}
+	}
 	
-	VideoEncode encode( "test.h264" );
-	if( !encode.open() ){
-		cout << "Could not create output file" << endl;
+	//Every frame processor loads it, so fail before starting
+	if( !options.lut.isEmpty() && !ColourLut().loadCube( options.lut ) )
 		return -1;
+	
+	if( !daemon_path.isEmpty() ){
+		int result = runDaemon( daemon_path, threads, options, next_output );
+		writeStats( stats_path );
+		return result;
+	}
+	
+	if( !batch_path.isEmpty() ){
+		int result = runBatch( batch_path, next_output, options, threads );
+		writeStats( stats_path );
+		return result;
 	}
 	
+	if( input.isEmpty() || outputs.empty() )
+		return showHelp( -1 );
+	
+	for( auto& settings : outputs ){
+		settings.io = options.io;
+		if( options.preview > 0 )
+			settings.preset = "ultrafast";
+	}
+	
+	VideoFile file( input );
+	
 	//Open video file
-	if( !(file.open()) ){
+	if( !(file.open( options.io )) ){
 		cout << "Couldn't open file!";
 		return -1;
 	}
 	
-	file.run( encode );
+	//Must move the old outputs aside before they are overwritten
+	vector<QString> paths;
+	for( auto& settings : outputs )
+		paths.push_back( settings.path );
+	Checkpoint checkpoint( paths );
+	if( options.resume ){
+		if( options.checkpoint <= 0 )
+			options.checkpoint = 10;
+		if( !checkpoint.load() )
+			cout << "No checkpoint found, starting from the beginning" << endl;
+		else if( !checkpoint.setAside() )
+			return -1;
+	}
+	else if( options.checkpoint > 0 )
+		checkpoint.remove(); //Left from an earlier run
+	
+	vector<unique_ptr<VideoEncode>> encoders;
+	vector<VideoEncode*> encoder_list;
+	for( auto& settings : outputs ){
+		settings.cuttable = options.checkpoint > 0;
+		encoders.emplace_back( new VideoEncode( settings ) );
+		encoders.back()->addPassthrough( file.formatContext(), file.streamIndex() );
+		if( !encoders.back()->open( file.frameRateQ(), file.width(), file.height(), VideoFrame::formatFor( file.depth() ) ) ){
+			cout << "Could not create output file " << settings.path.toLocal8Bit().constData() << endl;
+			return -1;
+		}
+		encoder_list.push_back( encoders.back().get() );
+	}
+	
+	file.run( encoder_list, options, options.checkpoint > 0 ? &checkpoint : nullptr );
+	writeStats( stats_path );
 	
 	return 0;
 }
@@ -0,0 +1,661 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Regression.hpp"
+#include "AsyncIO.hpp"
+#include "ColourLut.hpp"
+#include "Deinterlace.hpp"
+#include "Instrument.hpp"
+#include "VideoFrame.hpp"
+#include "VideoLine.hpp"
+#include "dump/DumpPlane.hpp"
+
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QSysInfo>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+using namespace std;
+
+namespace{
+	const char* plane_names[3] = { "y", "u", "v" };
+	const double min_psnr = 48.0;        ///Below this the output has changed, not just drifted
+	const double speed_tolerance = 0.8;  ///Fail if slower than 80% of the baseline
+	const unsigned speed_runs = 3;
+	const double frame_budget_ms = 40.0; ///Real time for 25 fps on one core
+	
+	///Throughput depends on the machine, so every one records its own
+	QString baselinePath( QString dir ){
+		return dir + "/baseline." + QSysInfo::machineHostName() + ".txt";
+	}
+	
+	QString planePath( QString dir, QString name, const char* kind, int plane ){
+		return dir + "/" + name + "." + kind + "." + plane_names[plane] + ".dump";
+	}
+	
+	bool readPlane( QString path, DumpPlane& plane ){
+		QFile f( path );
+		if( !f.open( QIODevice::ReadOnly ) )
+			return false;
+		return plane.read( f );
+	}
+	
+	bool writePlane( QString path, DumpPlane plane ){
+		QFile f( path );
+		if( !f.open( QIODevice::WriteOnly ) )
+			return false;
+		return plane.write( f );
+	}
+	
+	DumpPlane toDump( ffmpeg::Frame::Plane plane ){
+		vector<uint8_t> data;
+		data.reserve( plane.getWidth() * plane.getHeight() );
+		for( auto line : plane )
+			for( auto val : line )
+				data.push_back( val );
+		return DumpPlane( plane.getWidth(), plane.getHeight(), 8, data );
+	}
+	
+	bool toFrame( QString name, DumpPlane (&planes)[3], ffmpeg::Frame*& frame ){
+		frame = new ffmpeg::Frame( planes[0].getWidth(), planes[0].getHeight(), AV_PIX_FMT_YUV422P );
+		for( int p=0; p<3; p++ ){
+			auto out = frame->getPlane( p );
+			if( out.getWidth() != planes[p].getWidth() || out.getHeight() != planes[p].getHeight() ){
+				cout << name.toLocal8Bit().constData() << ": plane " << plane_names[p] << " is not 4:2:2" << endl;
+				delete frame;
+				return false;
+			}
+			for( unsigned iy=0; iy<out.getHeight(); iy++ ){
+				auto row = planes[p].constScanline( iy );
+				auto line = out[iy];
+				for( unsigned ix=0; ix<out.getWidth(); ix++ )
+					line[ix] = row[ix];
+			}
+		}
+		return true;
+	}
+	
+	bool loadInput( QString dir, QString name, ffmpeg::Frame*& frame ){
+		DumpPlane planes[3];
+		for( int p=0; p<3; p++ )
+			if( !readPlane( planePath( dir, name, "in", p ), planes[p] ) ){
+				cout << name.toLocal8Bit().constData() << ": could not read input plane " << plane_names[p] << endl;
+				return false;
+			}
+		return toFrame( name, planes, frame );
+	}
+	
+	uint32_t checksum( const DumpPlane& plane ){
+		uLong crc = crc32( 0, nullptr, 0 );
+		for( unsigned iy=0; iy<plane.getHeight(); iy++ )
+			crc = crc32( crc, plane.constScanline( iy ), plane.getWidth() );
+		return crc;
+	}
+	
+	double psnr( const DumpPlane& a, const DumpPlane& b ){
+		double sum = 0.0;
+		for( unsigned iy=0; iy<a.getHeight(); iy++ ){
+			auto row1 = a.constScanline( iy );
+			auto row2 = b.constScanline( iy );
+			for( unsigned ix=0; ix<a.getWidth(); ix++ ){
+				double diff = row1[ix] - row2[ix];
+				sum += diff * diff;
+			}
+		}
+		double mse = sum / ( double(a.getWidth()) * a.getHeight() );
+		return mse > 0 ? 10 * log10( 255.0 * 255.0 / mse ) : INFINITY;
+	}
+	
+	unsigned maxDifference( const DumpPlane& a, const DumpPlane& b ){
+		unsigned result = 0;
+		for( unsigned iy=0; iy<a.getHeight(); iy++ ){
+			auto row1 = a.constScanline( iy );
+			auto row2 = b.constScanline( iy );
+			for( unsigned ix=0; ix<a.getWidth(); ix++ )
+				result = max( result, unsigned( abs( row1[ix] - row2[ix] ) ) );
+		}
+		return result;
+	}
+	
+	const int synthetic_count = 4;
+	
+	///Deterministic test content mimicking the defects the filters target
+	ffmpeg::Frame* generateSynthetic( int variant ){
+		const unsigned width = 720, height = 576;
+		uint32_t seed = 12345 + variant;
+		auto noise = [&](){ seed = seed * 1103515245 + 12345; return int( (seed >> 16) % 17 ) - 8; };
+		auto clamp = []( int val ){ return uint8_t( max( 0, min( 255, val ) ) ); };
+		
+		vector<uint8_t> luma( width * height ), cb( width/2 * height ), cr( width/2 * height );
+		for( unsigned iy=0; iy<height; iy++ ){
+			//Odd lines are offset, and the head-switching band is stretched
+			double dx = (iy % 2) ? 1.5 + variant : 0.0;
+			double scale = iy >= height-8 ? 1.0 + 0.004 * (iy - (height-8)) : 1.0;
+			if( iy >= height-8 )
+				dx += 20 + 3 * variant;
+			
+			for( unsigned ix=0; ix<width; ix++ ){
+				double x = ix * scale + dx;
+				int val;
+				switch( variant ){
+					case 0: val = 16 + int( x / 4 ) % 220; break;
+					case 1: val = ( int( x / 24 ) % 2 ) ? 200 : 40; break;
+					case 2: val = 128 + int( 90 * sin( x / 11.0 ) * cos( iy / 37.0 ) ); break;
+					default: val = 128 + int( 60 * sin( x / 5.0 + iy / 90.0 ) ); break;
+				}
+				luma[iy*width + ix] = clamp( val + noise() );
+			}
+			
+			for( unsigned ix=0; ix<width/2; ix++ ){
+				cb[iy*width/2 + ix] = clamp( 128 + int( 40 * sin( (ix + iy) / 50.0 + variant ) ) + noise() );
+				cr[iy*width/2 + ix] = clamp( 128 + int( 40 * cos( ix / 30.0 - variant ) ) + noise() );
+			}
+		}
+		
+		DumpPlane planes[3]{ DumpPlane( width, height, 8, luma ), DumpPlane( width/2, height, 8, cb ), DumpPlane( width/2, height, 8, cr ) };
+		ffmpeg::Frame* frame = nullptr;
+		toFrame( QString( "synthetic%1" ).arg( variant ), planes, frame );
+		return frame;
+	}
+	
+	///The processing chain as it was before it was optimized, built from the
+	///reference kernels only. The synthetic samples are checked against this,
+	///so their goldens don't come from the code under test
+	void referenceProcess( ffmpeg::Frame& input, unsigned head_switch, DumpPlane (&out)[3] ){
+		const double scale = 5;
+		DumpPlane luma = toDump( input.getPlane( 0 ) );
+		unsigned width = luma.getWidth(), end = luma.getHeight() - head_switch;
+		auto line = [&]( unsigned y ){ return VideoLine( luma.scanline( y ), width ); };
+		auto upscale = [&]( unsigned y ){
+			vector<uint8_t> result;
+			reference::scaleLineEx( line( y ), scale, result );
+			return result;
+		};
+		auto bestShift = []( vector<uint8_t>& line1, vector<uint8_t>& line2, int amount ){
+			return reference::recursiveDiff( VideoLine( line1 ), VideoLine( line2 ), -amount, amount ).second;
+		};
+		
+		//Odd lines moved to the even lines around them
+		auto bottom = upscale( 0 );
+		for( unsigned iy=0; iy<end; iy+=2 ){
+			auto top = bottom;
+			bottom = upscale( iy+2 );
+			auto middle = upscale( iy+1 );
+			int best_x = bestShift( top, middle, 2*scale );
+			int best_x2 = bestShift( bottom, middle, 2*scale );
+			if( iy == 0 )
+				best_x = best_x2;
+			if( iy == end-2 )
+				best_x2 = best_x;
+			
+			auto moved = middle;
+			VideoLine from( middle ), to( moved );
+			reference::moveLine( from, to, (best_x+best_x2)/2 );
+			auto output = reference::scaleLineDown( VideoLine( moved ), scale );
+			copy( output.begin(), output.begin() + min( unsigned( output.size() ), width ), luma.scanline( iy+1 ) );
+		}
+		
+		//Head switching lines stretched and moved to the last line above them
+		vector<uint8_t> base( luma.scanline( end-2 ), luma.scanline( end-2 ) + width ), scaled;
+		for( unsigned iy=end; iy<luma.getHeight(); iy++ ){
+			double best_scale = 1.0;
+			int best_x = 0;
+			unsigned best_val = -1;
+			for( double iz = 1.000; iz<1.03; iz += 0.001 ){
+				reference::scaleLineEx( line( iy ), iz, scaled );
+				auto result = reference::recursiveDiff( VideoLine( base ), VideoLine( scaled ), -200, 200 );
+				if( result.first < best_val ){
+					best_val = result.first;
+					best_x = result.second;
+					best_scale = iz;
+				}
+			}
+			reference::scaleLineEx( line( iy ), best_scale, scaled );
+			VideoLine from( scaled ), to( luma.scanline( iy ), width );
+			reference::moveLine( from, to, best_x );
+		}
+		out[0] = luma;
+		
+		//Chroma line pairs blended to 4:2:0
+		for( int p=1; p<=2; p++ ){
+			auto in = input.getPlane( p );
+			vector<uint8_t> data;
+			for( unsigned iy=0; iy+1<in.getHeight(); iy+=2 )
+				for( unsigned ix=0; ix<in.getWidth(); ix++ )
+					data.push_back( (in[iy][ix] + in[iy+1][ix]) / 2 );
+			out[p] = DumpPlane( in.getWidth(), in.getHeight() / 2, 8, data );
+		}
+	}
+	
+	///Packed 4:2:2, as YUY2 captures are, must convert exactly like planar
+	bool checkPacked( ffmpeg::Frame& planar ){
+		if( !VideoFrame::canConvert( AV_PIX_FMT_YUYV422 ) )
+			return false;
+		ffmpeg::Frame packed( planar.width(), planar.height(), AV_PIX_FMT_YUYV422 );
+		for( int p=0; p<3; p++ ){
+			auto in = planar.getPlane( p );
+			auto out = packed.getPlane( p );
+			for( unsigned iy=0; iy<in.getHeight(); iy++ )
+				for( unsigned ix=0; ix<in.getWidth(); ix++ )
+					out[iy][ix] = in[iy][ix];
+		}
+		
+		VideoFrame from_planar( planar.width(), planar.height() ), from_packed( planar.width(), planar.height() );
+		from_planar.initFrame( planar );
+		from_packed.initFrame( packed );
+		for( int p=0; p<3; p++ )
+			if( checksum( toDump( from_planar.getPlane( p ) ) ) != checksum( toDump( from_packed.getPlane( p ) ) ) )
+				return false;
+		return true;
+	}
+	
+	QStringList sampleNames( QString dir ){
+		QStringList names;
+		QStringList filter;
+		filter << "*.in.y.dump";
+		for( auto file : QDir( dir ).entryList( filter, QDir::Files ) )
+			names << file.left( file.size() - QString( ".in.y.dump" ).size() );
+		return names;
+	}
+	
+	///Runs every optimized kernel against its reference on the luma lines
+	unsigned compareKernels( ffmpeg::Frame& frame ){
+		unsigned mismatches = 0;
+		auto check = [&]( bool equal, const char* kernel, unsigned y ){
+			if( !equal && mismatches++ < 10 )
+				cout << "\tKernel mismatch in " << kernel << " at line " << y << endl;
+		};
+		
+		//The overshoot at sharp edges must stay within 10 bits
+		vector<uint16_t> edges( frame.width() ), shifted( frame.width() ), scaled;
+		for( unsigned ix=0; ix<edges.size(); ix++ )
+			edges[ix] = (ix / 8) % 2 ? 1023 : 0;
+		VideoLine16 edge_line( edges );
+		shiftLine( edge_line, 5.0, 3, shifted.data(), 1023 );
+		scaleLineEx( edge_line, 1.013, scaled, 1023 );
+		check( *max_element( shifted.begin(), shifted.end() ) <= 1023, "shiftLine 10 bit", 0 );
+		check( *max_element( scaled.begin(), scaled.end() ) <= 1023, "scaleLineEx 10 bit", 0 );
+		
+		for( unsigned iy=0; iy+1<frame.height(); iy+=7 ){
+			vector<uint8_t> buffer( frame.scanline( iy ), frame.scanline( iy ) + frame.width() );
+			VideoLine line( buffer.data(), frame.width() );
+			
+			vector<uint8_t> fast, slow;
+			for( double scale : { 5.0, 1.0, 1.013, 1.029 } ){
+				scaleLineEx( line, scale, fast, 255 );
+				reference::scaleLineEx( line, scale, slow );
+				check( fast == slow, "scaleLineEx", iy );
+			}
+			
+			scaleLineEx( line, 5.0, fast, 255 );
+			VideoLine big( fast );
+			check( scaleLineDown( big, 5.0, 255 ) == reference::scaleLineDown( big, 5.0 ), "scaleLineDown", iy );
+			
+			vector<uint8_t> next( frame.scanline( iy+1 ), frame.scanline( iy+1 ) + frame.width() );
+			VideoLine other( next );
+			for( int dx=-200; dx<=200; dx+=7 )
+				check( diffLines( line, other, dx ) == reference::diffLines( line, other, dx ), "diffLines", iy );
+			check( recursiveDiff( line, other, -10, 10 ) == reference::recursiveDiff( line, other, -10, 10 ), "recursiveDiff", iy );
+			
+			for( int dx : { -9, -1, 0, 3, 10 } ){
+				vector<uint8_t> out1( frame.width() ), out2( frame.width() );
+				VideoLine o1( out1 ), o2( out2 );
+				moveLine( line, o1, dx );
+				reference::moveLine( line, o2, dx );
+				check( out1 == out2, "moveLine", iy );
+			}
+			
+			for( int dx : { -10, -3, 0, 4, 10 } ){
+				vector<uint8_t> out1( frame.width() ), out2( frame.width() );
+				shiftLine( line, 5.0, dx, out1.data(), 255 );
+				reference::shiftLine( line, 5.0, dx, out2.data() );
+				//Summed in a different order, so it may round differently
+				check( equal( out1.begin(), out1.end(), out2.begin(), []( int a, int b ){ return abs( a - b ) <= 1; } )
+					,	"shiftLine", iy );
+			}
+			
+			//The 16 bit kernels must agree with the 8 bit ones on 8 bit values
+			vector<uint16_t> wide( buffer.begin(), buffer.end() ), wide_next( next.begin(), next.end() );
+			VideoLine16 line16( wide.data(), frame.width() ), other16( wide_next );
+			for( int dx=-200; dx<=200; dx+=7 )
+				check( diffLines( line16, other16, dx ) == diffLines( line, other, dx ), "diffLines 16 bit", iy );
+			vector<uint16_t> fast16;
+			scaleLineEx( line16, 5.0, fast16, 255 );
+			scaleLineEx( line, 5.0, fast, 255 );
+			check( equal( fast.begin(), fast.end(), fast16.begin(), []( uint8_t a, uint16_t b ){ return a == uint8_t(b); } )
+				,	"scaleLineEx 16 bit", iy );
+		}
+		
+		return mismatches;
+	}
+	
+	///bands uses VideoFrame::processBands() instead of separate passes
+	double measureSpeed( vector<ffmpeg::Frame*>& inputs, bool bands=false ){
+		vector<unique_ptr<VideoFrame>> outputs;
+		for( auto input : inputs )
+			outputs.emplace_back( new VideoFrame( input->width(), input->height() ) );
+		
+		auto start = chrono::steady_clock::now();
+		for( unsigned i=0; i<speed_runs; i++ )
+			for( unsigned j=0; j<inputs.size(); j++ ){
+				if( bands )
+					outputs[j]->processBands( *inputs[j], nullptr );
+				else{
+					outputs[j]->initFrame( *inputs[j] );
+					outputs[j]->process();
+				}
+			}
+		double seconds = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+		return seconds > 0 ? speed_runs * inputs.size() / seconds : 0.0;
+	}
+	
+	double measureReferenceSpeed( vector<ffmpeg::Frame*>& inputs ){
+		auto start = chrono::steady_clock::now();
+		for( auto input : inputs ){
+			DumpPlane output[3];
+			referenceProcess( *input, VideoFrame( input->width(), input->height() ).headSwitchLines(), output );
+		}
+		double seconds = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+		return seconds > 0 ? inputs.size() / seconds : 0.0;
+	}
+	
+	///Bytes per frame moved into the last level cache and read from memory,
+	///measured with the hardware counters. Every frame starts with cold
+	///caches, as a newly decoded one would
+	bool measureTraffic( vector<ffmpeg::Frame*>& inputs, bool bands, double& cache_bytes, double& memory_bytes ){
+		instrument::CacheTraffic traffic;
+		if( !traffic.available() || inputs.empty() )
+			return false;
+		
+		vector<uint8_t> evict( 64 * 1024 * 1024 );
+		cache_bytes = memory_bytes = 0;
+		for( auto input : inputs ){
+			VideoFrame frame( input->width(), input->height() );
+			frame.initFrame( *input ); //So no page is touched for the first time
+			
+			volatile uint8_t* lines = evict.data();
+			for( size_t i=0; i<evict.size(); i+=64 )
+				lines[i]++;
+			
+			traffic.start();
+			if( bands )
+				frame.processBands( *input, nullptr );
+			else{
+				frame.initFrame( *input );
+				frame.process();
+			}
+			double cache, memory;
+			traffic.stop( cache, memory );
+			cache_bytes += cache / inputs.size();
+			memory_bytes += memory / inputs.size();
+		}
+		return true;
+	}
+	
+	///Milliseconds per frame deinterlacing the samples in turn, so each
+	///frame differs from the last one everywhere
+	double measureDeinterlace( vector<ffmpeg::Frame*>& inputs ){
+		vector<unique_ptr<VideoFrame>> frames;
+		for( auto input : inputs ){
+			frames.emplace_back( new VideoFrame( input->width(), input->height() ) );
+			frames.back()->initFrame( *input );
+		}
+		
+		Deinterlace deinterlace( 10 );
+		const unsigned count = 50;
+		double seconds = 0.0;
+		for( unsigned i=0; i<count; i++ ){
+			//A copy, so the samples stay unchanged
+			ffmpeg::Frame frame( *frames[i % frames.size()] );
+			auto start = chrono::steady_clock::now();
+			deinterlace.process( frame );
+			seconds += chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+		}
+		return seconds * 1000 / count;
+	}
+	
+	///Writes a file through WriteBehind like a muxer filling in its header
+	///at the end, and reads it back in and out of order through ReadAhead
+	bool checkIo( QString path, const IoSettings& io, bool& ring ){
+		vector<uint8_t> data( 3 * io.block_size + 12345 );
+		srand( 7 );
+		for( auto& val : data )
+			val = rand();
+		const int header = 64;
+		
+		{	WriteBehind writer( io );
+			if( !writer.open( path ) )
+				return false;
+			ring = writer.usesRing();
+			auto avio = writer.avio();
+			vector<uint8_t> placeholder( header, 0 );
+			avio_write( avio, placeholder.data(), header );
+			for( size_t pos=header; pos<data.size(); ){
+				int amount = min( data.size() - pos, size_t( 1000 + rand() % 50000 ) );
+				avio_write( avio, data.data() + pos, amount );
+				pos += amount;
+			}
+			avio_seek( avio, 0, SEEK_SET );
+			avio_write( avio, data.data(), header );
+			avio_seek( avio, data.size(), SEEK_SET );
+			if( !writer.close() )
+				return false;
+		}
+		
+		ReadAhead reader( io );
+		if( !reader.open( path ) )
+			return false;
+		auto avio = reader.avio();
+		vector<uint8_t> buffer( data.size() );
+		if( avio_size( avio ) != int64_t( data.size() )
+			|| avio_read( avio, buffer.data(), buffer.size() ) != int( buffer.size() ) || buffer != data )
+			return false;
+		
+		for( int i=0; i<100; i++ ){
+			int64_t pos = rand() % data.size();
+			int amount = min( int64_t( rand() % (2 * io.block_size) ), int64_t( data.size() ) - pos );
+			if( avio_seek( avio, pos, SEEK_SET ) != pos || avio_read( avio, buffer.data(), amount ) != amount
+				|| !equal( buffer.begin(), buffer.begin() + amount, data.begin() + pos ) )
+				return false;
+		}
+		return true;
+	}
+	
+	void freeInputs( vector<ffmpeg::Frame*>& inputs ){
+		for( auto frame : inputs )
+			delete frame;
+		inputs.clear();
+	}
+}
+
+int runRegression( QString dir ){
+	//Synthetic samples first, then any captured ones with stored goldens
+	vector<ffmpeg::Frame*> inputs;
+	QStringList names;
+	for( int i=0; i<synthetic_count; i++ ){
+		inputs.push_back( generateSynthetic( i ) );
+		names << QString( "synthetic%1" ).arg( i );
+	}
+	
+	bool failed = false;
+	for( auto name : sampleNames( dir ) ){
+		ffmpeg::Frame* input;
+		if( !loadInput( dir, name, input ) ){
+			failed = true;
+			continue;
+		}
+		inputs.push_back( input );
+		names << name;
+	}
+	
+	for( unsigned i=0; i<inputs.size(); i++ ){
+		auto& input = *inputs[i];
+		auto name = names[i];
+		cout << name.toLocal8Bit().constData() << ":";
+		
+		if( compareKernels( input ) > 0 ){
+			cout << " kernels FAIL";
+			failed = true;
+		}
+		
+		VideoFrame output( input.width(), input.height() );
+		output.initFrame( input );
+		output.process();
+		
+		//The fused path must give exactly the same output
+		VideoFrame banded( input.width(), input.height() );
+		banded.processBands( input, nullptr );
+		bool same = true;
+		for( int p=0; p<3; p++ )
+			same = same && checksum( toDump( banded.getPlane( p ) ) ) == checksum( toDump( output.getPlane( p ) ) );
+		cout << " bands " << (same ? "ok" : "FAIL");
+		failed = failed || !same;
+		
+		//Grading with an identity LUT may only round
+		ffmpeg::Frame graded( output );
+		ColourLut identity;
+		double zero[3]{ 0.0, 0.0, 0.0 }, one[3]{ 1.0, 1.0, 1.0 };
+		identity.generate( zero, one, one );
+		identity.process( graded );
+		unsigned colour_error = 0;
+		for( int p=0; p<3; p++ )
+			colour_error = max( colour_error, maxDifference( toDump( graded.getPlane( p ) ), toDump( output.getPlane( p ) ) ) );
+		cout << " colour " << (colour_error <= 1 ? "ok" : "FAIL");
+		failed = failed || colour_error > 1;
+		
+		DumpPlane goldens[3];
+		bool synthetic = int(i) < synthetic_count;
+		if( synthetic )
+			referenceProcess( input, output.headSwitchLines(), goldens );
+		for( int p=0; p<3; p++ ){
+			auto& golden = goldens[p];
+			if( !synthetic && !readPlane( planePath( dir, name, "out", p ), golden ) ){
+				cout << " " << plane_names[p] << " missing golden";
+				failed = true;
+				continue;
+			}
+			
+			auto result = toDump( output.getPlane( p ) );
+			if( result.getWidth() != golden.getWidth() || result.getHeight() != golden.getHeight() ){
+				cout << " " << plane_names[p] << " size FAIL";
+				failed = true;
+			}
+			else if( checksum( result ) == checksum( golden ) )
+				cout << " " << plane_names[p] << " ok";
+			else{
+				double quality = psnr( result, golden );
+				bool pass = quality >= min_psnr;
+				cout << " " << plane_names[p] << " " << quality << "dB " << (pass ? "drift" : "FAIL");
+				failed = failed || !pass;
+			}
+		}
+		cout << endl;
+	}
+	
+	bool packed_ok = checkPacked( *inputs[0] );
+	cout << "YUYV422: " << (packed_ok ? "ok" : "FAIL") << endl;
+	failed = failed || !packed_ok;
+	
+	//Timings only fail against a baseline recorded on this machine
+	QFile baseline_file( baselinePath( dir ) );
+	double fps = measureSpeed( inputs );
+	if( baseline_file.open( QIODevice::ReadOnly ) ){
+		double baseline = QString( baseline_file.readAll().constData() ).trimmed().toDouble();
+		bool pass = fps >= baseline * speed_tolerance;
+		cout << "Throughput: " << fps << " fps (baseline " << baseline << ") " << (pass ? "ok" : "FAIL") << endl;
+		failed = failed || !pass;
+	}
+	else
+		cout << "Throughput: " << fps << " fps (reference chain " << measureReferenceSpeed( inputs )
+			<< "), no baseline for this machine" << endl;
+	
+	cout << "Deinterlace: " << measureDeinterlace( inputs ) << " ms/frame (real time below " << frame_budget_ms << ")" << endl;
+	
+	//Separate passes against bands, informational only
+	{	double passes_cache, passes_memory, bands_cache, bands_memory;
+		bool measured = measureTraffic( inputs, false, passes_cache, passes_memory )
+			&& measureTraffic( inputs, true, bands_cache, bands_memory );
+		cout << "Passes: " << measureSpeed( inputs ) << " fps";
+		if( measured )
+			cout << ", " << passes_cache / 1024 << " KiB/frame into the LLC, " << passes_memory / 1024 << " KiB/frame from memory";
+		cout << endl;
+		cout << "Bands:  " << measureSpeed( inputs, true ) << " fps";
+		if( measured )
+			cout << ", " << bands_cache / 1024 << " KiB/frame into the LLC, " << bands_memory / 1024 << " KiB/frame from memory";
+		cout << endl;
+		if( !measured )
+			cout << "Cache traffic not measured, needs CONFIG += instrument and access to the perf counters" << endl;
+	}
+	
+	freeInputs( inputs );
+	
+	//The latency forces the writer thread instead of io_uring
+	IoSettings io;
+	io.block_size = 256 * 1024;
+	QString io_path = QDir::tempPath() + "/vhsfix-regress.tmp";
+	bool ring = false;
+	bool io_ok = checkIo( io_path, io, ring );
+	cout << "I/O: " << (ring ? "io_uring " : "thread ") << (io_ok ? "ok" : "FAIL");
+	io.latency = 5;
+	bool latency_ok = checkIo( io_path, io, ring );
+	cout << ", " << io.latency << "ms latency " << (latency_ok ? "ok" : "FAIL") << endl;
+	QFile::remove( io_path );
+	failed = failed || !io_ok || !latency_ok;
+	
+	cout << (failed ? "Regression FAILED" : "Regression passed") << endl;
+	return failed ? 1 : 0;
+}
+
+int updateRegression( QString dir ){
+	QDir().mkpath( dir );
+	vector<ffmpeg::Frame*> inputs;
+	for( int i=0; i<synthetic_count; i++ )
+		inputs.push_back( generateSynthetic( i ) );
+	
+	//The synthetic goldens come from the reference chain and aren't stored
+	for( auto name : sampleNames( dir ) ){
+		ffmpeg::Frame* input;
+		if( !loadInput( dir, name, input ) )
+			continue;
+		inputs.push_back( input );
+		
+		VideoFrame output( input->width(), input->height() );
+		output.initFrame( *input );
+		output.process();
+		for( int p=0; p<3; p++ )
+			writePlane( planePath( dir, name, "out", p ), toDump( output.getPlane( p ) ) );
+	}
+	
+	double fps = measureSpeed( inputs );
+	freeInputs( inputs );
+	
+	QFile baseline_file( baselinePath( dir ) );
+	if( !baseline_file.open( QIODevice::WriteOnly ) )
+		return -1;
+	baseline_file.write( QString::number( fps ).toLocal8Bit() );
+	cout << "Updated golden outputs, baseline " << fps << " fps" << endl;
+	return 0;
+}
@@ -0,0 +1,40 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REGRESSION_HPP
+#define REGRESSION_HPP
+
+#include <QString>
+
+/* Golden output check of the processing chain.
+ * The synthetic samples are generated on every run and checked against the
+ * chain rebuilt from the reference kernels. The samples in dir are DumpPlane
+ * files, tests/samples has a few whose goldens came from the reference chain:
+ *   name.in.y.dump  name.in.u.dump  name.in.v.dump    (YUV 4:2:2 planar input)
+ *   name.out.y.dump name.out.u.dump name.out.v.dump   (golden output)
+ * "baseline.<host>.txt" holds the throughput of that machine in frames per
+ * second. The timings only fail against it, without one they are shown. */
+
+///Compares the processing chain and the optimized kernels against the
+///references in dir, returns the process exit code
+int runRegression( QString dir );
+
+///Records the golden outputs of the samples and the throughput baseline
+///of this machine in dir
+int updateRegression( QString dir );
+
+#endif
@@ -0,0 +1,41 @@
+/*
+	This file is part of vhsfix.
+
+	vhsfix is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	vhsfix is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with vhsfix.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Regression.hpp"
+
+#include <QCoreApplication>
+#include <QStringList>
+
+#include <iostream>
+
+using namespace std;
+
+int main( int argc, char* argv[] ){
+	QCoreApplication a(argc, argv);
+	auto args = a.arguments();
+	
+	if( args.size() == 2 )
+		return runRegression( args[1] );
+	if( args.size() == 3 && args[1] == "--update" )
+		return updateRegression( args[2] );
+	
+	cout << "vhsfix-regress dir" << endl;
+	cout << "\tCompare processing against the reference chain and the golden outputs in dir" << endl;
+	cout << "vhsfix-regress --update dir" << endl;
+	cout << "\tRecord the golden outputs of the samples in dir and the throughput baseline of this machine" << endl;
+	return -1;
+}
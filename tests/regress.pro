@@ -0,0 +1,11 @@
+# Regression test of the processing chain, "make check" runs it on the samples
+TEMPLATE = app
+TARGET = vhsfix-regress
+include(../vhsfix.pri)
+
+HEADERS += Regression.hpp
+SOURCES += Regression.cpp main.cpp
+
+check.commands = ./$$TARGET $$PWD/samples
+check.depends = $$TARGET
+QMAKE_EXTRA_TARGETS += check
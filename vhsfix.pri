@@ -0,0 +1,15 @@
+# Settings and sources shared by vhsfix and the regression test
+CONFIG += console thread
+INCLUDEPATH += $$PWD/src
+QMAKE_CXXFLAGS += -std=c++11
+# -O2 only vectorizes loops needing no runtime checks and no scalar tail
+QMAKE_CXXFLAGS += -ftree-vectorize -fvect-cost-model=dynamic
+LIBS += -lz -llzma -lavcodec -lavformat -lavutil -lswscale
+
+# Per-stage timers and counters, enable with "qmake CONFIG+=instrument"
+instrument {
+	DEFINES += VHSFIX_INSTRUMENT
+}
+
+HEADERS += $$PWD/src/VideoFile.hpp $$PWD/src/VideoEncode.hpp $$PWD/src/VideoFrame.hpp $$PWD/src/ffmpeg.hpp $$PWD/src/Instrument.hpp $$PWD/src/VideoLine.hpp $$PWD/src/BoundedQueue.hpp $$PWD/src/Options.hpp $$PWD/src/FrameProcessor.hpp $$PWD/src/PacketIndex.hpp $$PWD/src/ChromaDenoise.hpp $$PWD/src/Stabilise.hpp $$PWD/src/WorkPool.hpp $$PWD/src/Batch.hpp $$PWD/src/Checkpoint.hpp $$PWD/src/Preview.hpp $$PWD/src/DecodePool.hpp $$PWD/src/Deinterlace.hpp $$PWD/src/AsyncIO.hpp $$PWD/src/ColourLut.hpp $$PWD/src/Arguments.hpp $$PWD/src/Daemon.hpp
+SOURCES += $$PWD/src/VideoFile.cpp $$PWD/src/VideoEncode.cpp $$PWD/src/VideoFrame.cpp $$PWD/src/dump/DumpPlane.cpp $$PWD/src/Instrument.cpp $$PWD/src/VideoLine.cpp $$PWD/src/FrameProcessor.cpp $$PWD/src/PacketIndex.cpp $$PWD/src/ChromaDenoise.cpp $$PWD/src/Stabilise.cpp $$PWD/src/WorkPool.cpp $$PWD/src/Batch.cpp $$PWD/src/Checkpoint.cpp $$PWD/src/Preview.cpp $$PWD/src/DecodePool.cpp $$PWD/src/Deinterlace.cpp $$PWD/src/AsyncIO.cpp $$PWD/src/ColourLut.cpp $$PWD/src/Arguments.cpp $$PWD/src/Daemon.cpp
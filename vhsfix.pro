@@ -1,10 +1,6 @@
 TEMPLATE = app
-CONFIG += console
 TARGET = vhsfix
-INCLUDEPATH += .
-QMAKE_CXXFLAGS += -std=c++11
-LIBS += -lz -llzma -lavcodec -lavformat -lavutil
+include(vhsfix.pri)
 
 # Input
-HEADERS += src/VideoFile.hpp src/VideoFrame.hpp src/ffmpeg.hpp
-SOURCES += src/VideoFile.cpp src/VideoFrame.cpp src/main.cpp src/dump/DumpPlane.cpp
+SOURCES += src/main.cpp